@@ -0,0 +1,236 @@
+/*
+ ============================================================================
+ Name        : benchSuite.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Benchmark suite for the runtime, printing one JSON object.
+               create_destroy   threads spawned, run and reaped per second
+               yield_pingpong   two threads yielding to each other
+               preemption       CPU-bound work split over threads at
+                                several quanta against one thread alone
+               scheduling       cost of a yield against thread count
+               memory           resident memory per blocked thread, and
+                                how much of its stack one has used
+               wakeup           semaphore post to wakee running, and
+                                thread_sleep lateness, as percentiles
+               Times are in ns. Runs in single mode, about 10 s.
+               The tick is a per-pthread CLOCK_MONOTONIC timer, so quanta
+               are kept to the microsecond rather than rounded up to the
+               kernel tick. The preemption runs use the rr policy with the
+               adaptive slice off, so threads are switched every quantum
+               they name.
+               gcc -O2 -pthread benchSuite.c -o benchSuite && ./benchSuite
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "littleThread.h"
+#include "littleThread.c"
+
+#define CREATE_THREADS 20000
+#define PINGPONG_YIELDS 1000000
+#define PREEMPT_WORK 400000000L // LCG steps, about 1 s
+#define PREEMPT_THREADS 8
+#define SCHED_SWITCHES 2000000
+#define MEMORY_THREADS 10000
+#define WAKEUPS 100000
+#define SLEEPS 500
+#define SLEEP_NS 1000000
+
+volatile unsigned int sink;
+int yields;
+long workPerThread;
+Semaphore ping, pong, release;
+long long stamp;
+long long *latencies;
+size_t residentBefore, residentAfter, stackUsed;
+ThreadHandle firstBlocked;
+
+/*
+ * Resident set size in bytes, from /proc/self/statm.
+ */
+size_t residentBytes() {
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL) {
+        if (fscanf(statm, "%*s %ld", &pages) != 1) pages = 0;
+        fclose(statm);
+    }
+    return pages * sysconf(_SC_PAGESIZE);
+}
+
+int compareLongLong(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Sorts the samples and prints them as a JSON object of percentiles.
+ */
+void printPercentiles(const char *name, long long *samples, int count) {
+    qsort(samples, count, sizeof(long long), compareLongLong);
+    printf("    \"%s\": {\"samples\": %d, \"p50\": %lld, \"p90\": %lld, \"p99\": %lld, \"p999\": %lld, \"max\": %lld}",
+            name, count, samples[count / 2], samples[count * 9 / 10], samples[count * 99 / 100],
+            samples[count * 999 / 1000], samples[count - 1]);
+}
+
+void nothing(void *arg) {
+}
+
+void yielder(void *arg) {
+    for (int i = 0; i < yields; i++) threadYield();
+}
+
+void cpuBound(void *arg) {
+    unsigned int x = 1;
+    for (long i = 0; i < workPerThread; i++) x = x * 1103515245 + 12345;
+    sink = x;
+}
+
+void blocked(void *arg) {
+    thread_sem_wait(&release);
+}
+
+void measurer(void *arg) { // runs once every blocked thread has blocked
+    residentAfter = residentBytes();
+    stackUsed = thread_stack_high_water(firstBlocked);
+    for (int i = 0; i < MEMORY_THREADS; i++) thread_sem_post(&release);
+}
+
+void waker(void *arg) {
+    for (int i = 0; i < WAKEUPS; i++) {
+        stamp = thread_now();
+        thread_sem_post(&ping);
+        thread_sem_wait(&pong);
+    }
+}
+
+void wakee(void *arg) {
+    for (int i = 0; i < WAKEUPS; i++) {
+        thread_sem_wait(&ping);
+        latencies[i] = thread_now() - stamp;
+        thread_sem_post(&pong);
+    }
+}
+
+void sleeper(void *arg) {
+    for (int i = 0; i < SLEEPS; i++) {
+        long long start = thread_now();
+        thread_sleep(SLEEP_NS);
+        latencies[i] = thread_now() - start - SLEEP_NS;
+    }
+}
+
+void benchCreateDestroy() {
+    double start = thread_now(), ns;
+
+    for (int i = 0; i < CREATE_THREADS; i++) thread_spawn(nothing, NULL);
+    setUpTimer();
+    ns = (thread_now() - start) / CREATE_THREADS;
+    printf("  \"create_destroy\": {\"threads\": %d, \"ns_per_thread\": %.1f, \"threads_per_second\": %.0f},\n",
+            CREATE_THREADS, ns, 1e9 / ns);
+}
+
+void benchYieldPingPong() {
+    double start;
+
+    yields = PINGPONG_YIELDS / 2;
+    thread_spawn(yielder, NULL);
+    thread_spawn(yielder, NULL);
+    start = thread_now();
+    setUpTimer();
+    printf("  \"yield_pingpong\": {\"yields\": %d, \"ns_per_yield\": %.1f},\n",
+            PINGPONG_YIELDS, (thread_now() - start) / PINGPONG_YIELDS);
+}
+
+void benchPreemption() {
+    long long quanta[] = { 100000, 1000000, 5000000, 20000000 };
+    int count = sizeof(quanta) / sizeof(quanta[0]);
+    const char *policy;
+    double start, alone;
+
+    workPerThread = PREEMPT_WORK; // one thread, the timer stays off
+    thread_spawn(cpuBound, NULL);
+    start = thread_now();
+    setUpTimer();
+    alone = thread_now() - start;
+    printf("  \"preemption\": {\"threads\": %d, \"alone_ns\": %.0f, \"quanta\": [\n", PREEMPT_THREADS, alone);
+    workPerThread = PREEMPT_WORK / PREEMPT_THREADS;
+    policy = thread_policy_name();
+    thread_set_policy("rr"); // mlfq gives CPU-bound threads several quanta
+    thread_set_adaptive_quantum(0); // it would stretch the slice of CPU-bound threads
+    for (int q = 0; q < count; q++) {
+        double ns;
+        thread_set_quantum(quanta[q]);
+        for (int t = 0; t < PREEMPT_THREADS; t++) thread_spawn(cpuBound, NULL);
+        start = thread_now();
+        setUpTimer();
+        ns = thread_now() - start;
+        printf("    {\"quantum_ns\": %lld, \"elapsed_ns\": %.0f, \"overhead_percent\": %.2f}%s\n",
+                quanta[q], ns, (ns - alone) * 100 / alone, q < count - 1 ? "," : "");
+    }
+    thread_set_quantum(20000000);
+    thread_set_adaptive_quantum(1);
+    thread_set_policy(policy);
+    printf("  ]},\n");
+}
+
+void benchScheduling() {
+    printf("  \"scheduling\": [\n");
+    for (int count = 10; count <= 100000; count *= 10) {
+        double start;
+        yields = SCHED_SWITCHES / count > 10 ? SCHED_SWITCHES / count : 10;
+        for (int t = 0; t < count; t++) thread_spawn(yielder, NULL);
+        start = thread_now();
+        setUpTimer();
+        printf("    {\"threads\": %d, \"ns_per_yield\": %.1f}%s\n",
+                count, (thread_now() - start) / ((double) count * yields), count < 100000 ? "," : "");
+    }
+    printf("  ],\n");
+}
+
+void benchMemory() {
+    stackPoolConfigure(DEFAULT_STACKSIZE, DEFAULT_TRIM_WATERMARK, 1); // unmaps pooled stacks, already resident
+    thread_sem_init(&release, 0);
+    residentBefore = residentBytes();
+    firstBlocked = thread_spawn(blocked, NULL);
+    for (int i = 1; i < MEMORY_THREADS; i++) thread_spawn(blocked, NULL);
+    thread_spawn(measurer, NULL);
+    setUpTimer();
+    printf("  \"memory\": {\"threads\": %d, \"stack_bytes\": %zu, \"control_block_bytes\": %zu, \"resident_bytes_per_thread\": %.0f, \"stack_high_water_bytes\": %zu},\n",
+            MEMORY_THREADS, stackPoolStackSize(), sizeof(struct thread),
+            (double) (residentAfter - residentBefore) / MEMORY_THREADS, stackUsed);
+}
+
+void benchWakeup() {
+    latencies = malloc(sizeof(long long) * WAKEUPS);
+    thread_sem_init(&ping, 0);
+    thread_sem_init(&pong, 0);
+    thread_spawn(wakee, NULL);
+    thread_spawn(waker, NULL);
+    setUpTimer();
+    printf("  \"wakeup\": {\n");
+    printPercentiles("semaphore", latencies, WAKEUPS);
+    printf(",\n");
+    thread_spawn(sleeper, NULL);
+    setUpTimer();
+    printPercentiles("sleep_lateness", latencies, SLEEPS);
+    printf("\n  }\n");
+    free(latencies);
+}
+
+int main(void) {
+    threadInit();
+    printf("{\n");
+    benchCreateDestroy();
+    benchYieldPingPong();
+    benchPreemption();
+    benchMemory();
+    stackPoolConfigure(16 * 1024, -1, 0); // 100000 guarded stacks exceed vm.max_map_count
+    benchScheduling();
+    benchWakeup();
+    printf("}\n");
+    return EXIT_SUCCESS;
+}
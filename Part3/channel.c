@@ -0,0 +1,287 @@
+/*
+ ============================================================================
+ Name        : channel.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Channels. Elements go through a ring buffer, or straight
+               between a sender and a receiver when one of them is
+               blocked on the channel: a sender finding a receiver waiting
+               copies into the receiver's element and switches straight to
+               it (threadWakeSwitch) if it would run next anyway, as does a
+               receiver taking from a sender waiting on an unbuffered
+               channel; otherwise the peer is only woken, so deadline
+               threads and the policy keep their order.
+               Blocked senders and receivers share one wait queue, as only
+               one kind can be waiting at a time; its guard locks the
+               channel. The batch calls move as many elements as they can
+               under one lock and wake the peers together, without
+               switching.
+ ============================================================================
+ */
+
+#define CHANNEL_INITIAL_SLOTS 16 // of an unbounded channel, doubled when full
+
+/* What a blocked sender or receiver waits with, in its waitData */
+typedef struct chanWait {
+    char *elem; // to send or receive into
+    int status; // 0 waiting, 1 done, -1 closed
+} ChanWait;
+
+/* A list of threads to wake, in order */
+typedef struct chanWoken {
+    Thread head, tail;
+} ChanWoken;
+
+static char *chanSlot(Channel *chan, int index) {
+    return chan->buffer + (size_t) ((chan->head + index) % chan->slots) * chan->elemSize;
+}
+
+/*
+ * Whether the buffer has room for another element, growing an unbounded
+ * one that is full. The guard must be held.
+ */
+static int chanRoom(Channel *chan) {
+    char *buffer;
+
+    if (chan->count < chan->slots) return 1;
+    if (chan->capacity != CHANNEL_UNBOUNDED) return 0;
+    if ((buffer = malloc(chan->elemSize * chan->slots * 2)) == NULL) {
+        perror("growing channel");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < chan->count; i++) memcpy(buffer + i * chan->elemSize, chanSlot(chan, i), chan->elemSize);
+    free(chan->buffer);
+    chan->buffer = buffer;
+    chan->head = 0;
+    chan->slots *= 2;
+    return 1;
+}
+
+static void chanPush(Channel *chan, const void *elem) {
+    memcpy(chanSlot(chan, chan->count), elem, chan->elemSize);
+    chan->count++;
+}
+
+static void chanPop(Channel *chan, void *elem) {
+    memcpy(elem, chanSlot(chan, 0), chan->elemSize);
+    chan->head = (chan->head + 1) % chan->slots;
+    chan->count--;
+}
+
+/*
+ * Takes the first waiting sender (sender 1) or receiver (sender 0), if
+ * that kind is waiting. The guard must be held.
+ */
+static ChanWait *chanPeer(Channel *chan, int sender, Thread *thread) {
+    if (chan->waiters.head == NULL || chan->sendersWait != sender) return NULL;
+    *thread = waitDequeue(&chan->waiters);
+    return (*thread)->waitData;
+}
+
+static void chanWake(ChanWoken *woken, Thread thread) {
+    thread->waitNext = NULL;
+    if (woken->tail == NULL) woken->head = thread;
+    else woken->tail->waitNext = thread;
+    woken->tail = thread;
+}
+
+/*
+ * Parks the running thread on the channel, whose guard must be held with
+ * preemption disabled, until a peer has taken or filled elem or the
+ * channel is closed. Returns 1 or -1 respectively.
+ */
+static int chanWait(Channel *chan, int sender, char *elem) {
+    ChanWait wait = { elem, 0 };
+
+    thread_self()->waitData = &wait;
+    chan->sendersWait = sender;
+    waitOn(&chan->waiters);
+    return wait.status;
+}
+
+int thread_chan_init(Channel *chan, size_t elemSize, int capacity) {
+    memset(chan, 0, sizeof(Channel));
+    chan->elemSize = elemSize;
+    chan->capacity = capacity;
+    chan->slots = capacity == CHANNEL_UNBOUNDED ? CHANNEL_INITIAL_SLOTS : capacity;
+    if (chan->slots > 0 && (chan->buffer = malloc(elemSize * chan->slots)) == NULL) return -1;
+    return 0;
+}
+
+/*
+ * Frees the buffer. Nobody may be using the channel.
+ */
+void thread_chan_destroy(Channel *chan) {
+    free(chan->buffer);
+    chan->buffer = NULL;
+}
+
+/*
+ * Sends a copy of elem, waiting for room or, unbuffered, for a receiver.
+ */
+int thread_chan_send(Channel *chan, const void *elem) {
+    Thread peer;
+    ChanWait *wait;
+    int status = 0;
+
+    preempt_disable();
+    spinLock(&chan->waiters.guard);
+    if (chan->closed) {
+        status = -1;
+    } else if ((wait = chanPeer(chan, 0, &peer)) != NULL) { // so the buffer is empty
+        memcpy(wait->elem, elem, chan->elemSize);
+        wait->status = 1;
+        spinUnlock(&chan->waiters.guard);
+        threadWakeSwitch(peer);
+        preempt_enable();
+        return 0;
+    } else if (chanRoom(chan)) {
+        chanPush(chan, elem);
+    } else {
+        status = chanWait(chan, 1, (char *) elem) == 1 ? 0 : -1;
+        preempt_enable();
+        return status;
+    }
+    spinUnlock(&chan->waiters.guard);
+    preempt_enable();
+    return status;
+}
+
+/*
+ * Receives the oldest element into elem, waiting for one. Returns 1, or 0
+ * if the channel has been closed and everything sent has been received.
+ */
+int thread_chan_recv(Channel *chan, void *elem) {
+    Thread peer = NULL;
+    ChanWait *wait;
+    int got = 1, direct = 0;
+
+    preempt_disable();
+    spinLock(&chan->waiters.guard);
+    if (chan->count > 0) {
+        chanPop(chan, elem);
+        if ((wait = chanPeer(chan, 1, &peer)) != NULL) { // it waited for the room
+            chanPush(chan, wait->elem);
+            wait->status = 1;
+        }
+    } else if ((wait = chanPeer(chan, 1, &peer)) != NULL) { // unbuffered
+        memcpy(elem, wait->elem, chan->elemSize);
+        wait->status = 1;
+        direct = 1;
+    } else if (chan->closed) {
+        got = 0;
+    } else {
+        got = chanWait(chan, 0, elem) == 1;
+        preempt_enable();
+        return got;
+    }
+    spinUnlock(&chan->waiters.guard);
+    if (peer != NULL) {
+        if (direct) threadWakeSwitch(peer);
+        else threadWake(peer);
+    }
+    preempt_enable();
+    return got;
+}
+
+/*
+ * Sends count elements from elems, in order, waiting whenever there is
+ * no room. Returns how many were sent, fewer than count only if the
+ * channel was closed.
+ */
+int thread_chan_send_batch(Channel *chan, const void *elems, int count) {
+    const char *next = elems;
+    ChanWoken woken = { NULL, NULL };
+    Thread peer;
+    ChanWait *wait;
+    int sent = 0;
+
+    preempt_disable();
+    spinLock(&chan->waiters.guard);
+    while (sent < count && !chan->closed) {
+        if ((wait = chanPeer(chan, 0, &peer)) != NULL) {
+            memcpy(wait->elem, next, chan->elemSize);
+            wait->status = 1;
+            chanWake(&woken, peer);
+        } else if (chanRoom(chan)) {
+            chanPush(chan, next);
+        } else { // full, let the receivers served so far run while we wait
+            wakeAll(woken.head); // they are off the queue, so its guard may be held
+            woken.head = woken.tail = NULL;
+            if (chanWait(chan, 1, (char *) next) != 1) {
+                preempt_enable();
+                return sent;
+            }
+            spinLock(&chan->waiters.guard);
+        }
+        sent++;
+        next += chan->elemSize;
+    }
+    spinUnlock(&chan->waiters.guard);
+    wakeAll(woken.head);
+    preempt_enable();
+    return sent;
+}
+
+/*
+ * Receives up to max elements into elems, waiting only if there are
+ * none. Returns how many, 0 once the channel has been closed and
+ * everything sent has been received.
+ */
+int thread_chan_recv_batch(Channel *chan, void *elems, int max) {
+    char *next = elems;
+    ChanWoken woken = { NULL, NULL };
+    Thread peer;
+    ChanWait *wait;
+    int got = 0;
+
+    preempt_disable();
+    spinLock(&chan->waiters.guard);
+    while (got < max) {
+        if (chan->count > 0) {
+            chanPop(chan, next);
+            if ((wait = chanPeer(chan, 1, &peer)) != NULL) {
+                chanPush(chan, wait->elem);
+                wait->status = 1;
+                chanWake(&woken, peer);
+            }
+        } else if ((wait = chanPeer(chan, 1, &peer)) != NULL) {
+            memcpy(next, wait->elem, chan->elemSize);
+            wait->status = 1;
+            chanWake(&woken, peer);
+        } else {
+            break;
+        }
+        got++;
+        next += chan->elemSize;
+    }
+    if (got == 0 && !chan->closed) {
+        got = chanWait(chan, 0, next) == 1;
+        preempt_enable();
+        return got;
+    }
+    spinUnlock(&chan->waiters.guard);
+    wakeAll(woken.head);
+    preempt_enable();
+    return got;
+}
+
+/*
+ * Closes the channel: sends fail from now on, and receives once it is
+ * drained. Waiting senders and receivers are woken to find it closed.
+ */
+void thread_chan_close(Channel *chan) {
+    Thread waiters;
+
+    preempt_disable();
+    spinLock(&chan->waiters.guard);
+    chan->closed = 1;
+    waiters = chan->waiters.head;
+    chan->waiters.head = chan->waiters.tail = NULL;
+    for (Thread thread = waiters; thread != NULL; thread = thread->waitNext) {
+        ((ChanWait *) thread->waitData)->status = -1;
+    }
+    spinUnlock(&chan->waiters.guard);
+    wakeAll(waiters);
+    preempt_enable();
+}
@@ -0,0 +1,117 @@
+/*
+ ============================================================================
+ Name        : channelTest.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Channels. A producer, a doubling stage and a consumer pass
+               ELEMENTS numbers through two channels, unbuffered, of one
+               slot, of 64 and unbounded, one element and a batch at a
+               time; the consumer's total must come out right. Then a
+               deadline thread sends to a best-effort thread blocked on an
+               unbuffered channel, and must not be switched out for it.
+               Exits with 0 if all is well. With an argument, the
+               pipelines run on that many workers.
+               gcc -O2 channelTest.c -o channelTest && ./channelTest [workers]
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "littleThread.h"
+#include "littleThread.c"
+
+#define ELEMENTS 100000
+#define BATCH 64
+
+Channel in, out;
+int batch;
+long total;
+volatile int received;
+
+void producer(void *arg) {
+    long elems[BATCH];
+
+    for (long i = 0; i < ELEMENTS; i += batch ? BATCH : 1) {
+        if (!batch) {
+            thread_chan_send(&in, &i);
+            continue;
+        }
+        for (int j = 0; j < BATCH; j++) elems[j] = i + j;
+        thread_chan_send_batch(&in, elems, i + BATCH <= ELEMENTS ? BATCH : ELEMENTS - i);
+    }
+    thread_chan_close(&in);
+}
+
+void stage(void *arg) {
+    long elems[BATCH];
+    int count;
+
+    while ((count = batch ? thread_chan_recv_batch(&in, elems, BATCH) : thread_chan_recv(&in, elems)) > 0) {
+        for (int j = 0; j < count; j++) elems[j] *= 2;
+        if (batch) thread_chan_send_batch(&out, elems, count);
+        else thread_chan_send(&out, elems);
+    }
+    thread_chan_close(&out);
+}
+
+void consumer(void *arg) {
+    long elems[BATCH];
+    int count;
+
+    while ((count = batch ? thread_chan_recv_batch(&out, elems, BATCH) : thread_chan_recv(&out, elems)) > 0) {
+        for (int j = 0; j < count; j++) total += elems[j];
+    }
+}
+
+void receiver(void *arg) {
+    int elem;
+
+    thread_chan_recv(&in, &elem);
+    received = 1;
+}
+
+void deadlineSender(void *arg) {
+    int elem = 1, *overtaken = arg;
+
+    thread_set_deadline(thread_handle(thread_self()), 50000000, 10000000);
+    thread_chan_send(&in, &elem);
+    *overtaken = received; // the receiver is READY, but must wait its turn
+}
+
+int main(int argc, char **argv) {
+    int workers = argc > 1 ? atoi(argv[1]) : 0;
+    int capacities[] = { 0, 1, 64, CHANNEL_UNBOUNDED };
+    int failed = 0, overtaken = -1;
+
+    threadInit();
+    for (batch = 0; batch < 2; batch++) {
+        for (int c = 0; c < 4; c++) {
+            thread_chan_init(&in, sizeof(long), capacities[c]);
+            thread_chan_init(&out, sizeof(long), capacities[c]);
+            total = 0;
+            thread_spawn(consumer, NULL);
+            thread_spawn(stage, NULL);
+            thread_spawn(producer, NULL);
+            if (workers > 0) threadRunWorkers(workers);
+            else setUpTimer();
+            if (total != (long) ELEMENTS * (ELEMENTS - 1)) {
+                printf("%s, capacity %d: total %ld\n", batch ? "batch" : "single", capacities[c], total);
+                failed = 1;
+            }
+            thread_chan_destroy(&in);
+            thread_chan_destroy(&out);
+        }
+    }
+    thread_chan_init(&in, sizeof(int), 0);
+    thread_spawn(receiver, NULL);
+    thread_spawn(deadlineSender, &overtaken);
+    setUpTimer();
+    thread_chan_destroy(&in);
+    if (overtaken != 0) {
+        printf("a deadline sender was switched out for its receiver\n");
+        failed = 1;
+    }
+    printf("%s\n", failed ? "failed" : "ok");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
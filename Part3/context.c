@@ -0,0 +1,166 @@
+/*
+ ============================================================================
+ Name        : context.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : User-space context switch for x86-64 and AArch64.
+               Only the callee-saved registers and the stack pointer are
+               saved, so a switch is a few dozen instructions and never
+               touches the signal mask. A new thread's first context is
+               made by hand on its stack, so starting one costs no
+               syscalls. Build with -DUSE_SETJMP to fall back to
+               setjmp/longjmp (see littleThread.h), where new threads are
+               started through a signal handler on their stack instead.
+ ============================================================================
+ */
+
+#ifndef USE_SETJMP
+
+#if defined(__x86_64__)
+
+/*
+ * Context layout (see struct context):
+ *   0 rsp, 8 rip, 16 rbx, 24 rbp, 32 r12, 40 r13, 48 r14, 56 r15
+ * The saved rsp/rip are those of the caller after the call returns, so
+ * restoring a context looks like saveContext (or switchContext) returning.
+ * MXCSR and the x87 control word are shared by all threads, as with
+ * setjmp; reloading MXCSR on every switch costs more than the rest of it.
+ */
+__asm__(
+    ".text\n"
+    ".globl saveContext\n"
+    ".type saveContext, @function\n"
+    "saveContext:\n"
+    "    movq (%rsp), %rax\n"
+    "    leaq 8(%rsp), %rdx\n"
+    "    movq %rdx, 0(%rdi)\n"
+    "    movq %rax, 8(%rdi)\n"
+    "    movq %rbx, 16(%rdi)\n"
+    "    movq %rbp, 24(%rdi)\n"
+    "    movq %r12, 32(%rdi)\n"
+    "    movq %r13, 40(%rdi)\n"
+    "    movq %r14, 48(%rdi)\n"
+    "    movq %r15, 56(%rdi)\n"
+    "    xorl %eax, %eax\n"
+    "    ret\n"
+    ".size saveContext, .-saveContext\n"
+
+    ".globl switchContext\n"
+    ".type switchContext, @function\n"
+    "switchContext:\n"
+    "    movq (%rsp), %rax\n"
+    "    leaq 8(%rsp), %rdx\n"
+    "    movq %rdx, 0(%rdi)\n"
+    "    movq %rax, 8(%rdi)\n"
+    "    movq %rbx, 16(%rdi)\n"
+    "    movq %rbp, 24(%rdi)\n"
+    "    movq %r12, 32(%rdi)\n"
+    "    movq %r13, 40(%rdi)\n"
+    "    movq %r14, 48(%rdi)\n"
+    "    movq %r15, 56(%rdi)\n"
+    "    movq %rsi, %rdi\n"
+    // falls through into restoreContext
+    ".globl restoreContext\n"
+    ".type restoreContext, @function\n"
+    "restoreContext:\n"
+    "    movq 16(%rdi), %rbx\n"
+    "    movq 24(%rdi), %rbp\n"
+    "    movq 32(%rdi), %r12\n"
+    "    movq 40(%rdi), %r13\n"
+    "    movq 48(%rdi), %r14\n"
+    "    movq 56(%rdi), %r15\n"
+    "    movq 0(%rdi), %rsp\n"
+    "    movl $1, %eax\n"
+    "    jmpq *8(%rdi)\n"
+    ".size restoreContext, .-restoreContext\n"
+    ".size switchContext, restoreContext-switchContext\n"
+);
+
+#elif defined(__aarch64__)
+
+/*
+ * Context layout (see struct context):
+ *   0..88 x19-x30 (x29 is the frame pointer, x30 the return address),
+ *   96 sp, 104..160 d8-d15
+ */
+__asm__(
+    ".text\n"
+    ".globl saveContext\n"
+    ".type saveContext, %function\n"
+    "saveContext:\n"
+    "    stp x19, x20, [x0, #0]\n"
+    "    stp x21, x22, [x0, #16]\n"
+    "    stp x23, x24, [x0, #32]\n"
+    "    stp x25, x26, [x0, #48]\n"
+    "    stp x27, x28, [x0, #64]\n"
+    "    stp x29, x30, [x0, #80]\n"
+    "    mov x16, sp\n"
+    "    str x16, [x0, #96]\n"
+    "    stp d8, d9, [x0, #104]\n"
+    "    stp d10, d11, [x0, #120]\n"
+    "    stp d12, d13, [x0, #136]\n"
+    "    stp d14, d15, [x0, #152]\n"
+    "    mov w0, #0\n"
+    "    ret\n"
+    ".size saveContext, .-saveContext\n"
+
+    ".globl switchContext\n"
+    ".type switchContext, %function\n"
+    "switchContext:\n"
+    "    stp x19, x20, [x0, #0]\n"
+    "    stp x21, x22, [x0, #16]\n"
+    "    stp x23, x24, [x0, #32]\n"
+    "    stp x25, x26, [x0, #48]\n"
+    "    stp x27, x28, [x0, #64]\n"
+    "    stp x29, x30, [x0, #80]\n"
+    "    mov x16, sp\n"
+    "    str x16, [x0, #96]\n"
+    "    stp d8, d9, [x0, #104]\n"
+    "    stp d10, d11, [x0, #120]\n"
+    "    stp d12, d13, [x0, #136]\n"
+    "    stp d14, d15, [x0, #152]\n"
+    "    mov x0, x1\n"
+    // falls through into restoreContext
+    ".globl restoreContext\n"
+    ".type restoreContext, %function\n"
+    "restoreContext:\n"
+    "    ldp x19, x20, [x0, #0]\n"
+    "    ldp x21, x22, [x0, #16]\n"
+    "    ldp x23, x24, [x0, #32]\n"
+    "    ldp x25, x26, [x0, #48]\n"
+    "    ldp x27, x28, [x0, #64]\n"
+    "    ldp x29, x30, [x0, #80]\n"
+    "    ldr x16, [x0, #96]\n"
+    "    mov sp, x16\n"
+    "    ldp d8, d9, [x0, #104]\n"
+    "    ldp d10, d11, [x0, #120]\n"
+    "    ldp d12, d13, [x0, #136]\n"
+    "    ldp d14, d15, [x0, #152]\n"
+    "    mov w0, #1\n"
+    "    ret\n"
+    ".size restoreContext, .-restoreContext\n"
+    ".size switchContext, restoreContext-switchContext\n"
+);
+
+#endif
+
+/*
+ * Sets up a context which, restored, calls entry at the top of the stack
+ * of size bytes at stack, as if called there from nowhere. entry must
+ * not return.
+ */
+static void contextInit(Context ctx, void *stack, size_t size, void (*entry)()) {
+    void **top = (void **) (((unsigned long) stack + size) & ~15UL); // 16-byte aligned
+
+    memset(ctx, 0, sizeof(Context));
+#if defined(__x86_64__)
+    *--top = NULL; // the return address, so rsp is as on entry to any function
+    ctx->rsp = top;
+    ctx->rip = entry;
+#else
+    ctx->sp = top;
+    ctx->x[11] = entry; // x30, the link register restoreContext returns to
+#endif
+}
+
+#endif /* USE_SETJMP */
@@ -0,0 +1,177 @@
+/*
+ ============================================================================
+ Name        : coroutine.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Stackless coroutines. A coroutine is a struct thread with
+               no stack, its frame allocated beside it, so it costs a few
+               hundred bytes rather than a stack. It sits in the same
+               ready queues and deques as the stackful threads; whoever
+               takes it from there, the scheduler in single mode or a
+               worker's loop, calls its step function on its own stack
+               with preemption disabled, and requeues, parks or retires
+               it by what the step returns.
+               The CO_ macros are a Duff's device switch on the line the
+               step last left at, kept in the control block.
+               A coroutine waiting to join is parked on the joined
+               thread's wait queue like a stackful thread, the queue's
+               guard held until its step has returned.
+ ============================================================================
+ */
+
+static __thread atomic_int *coroutineParkLock; // released once the parking step has returned
+
+static ThreadHandle spawnCoroutine(int (*step)(Thread, void *), size_t frameSize, const void *frame, int returnsValue);
+
+/*
+ * Runs one step of a READY coroutine. Preemption must be disabled.
+ */
+static void runCoroutine(Thread thread) {
+    int (*step)(Thread, void *) = (int (*)(Thread, void *)) thread->start;
+    Worker *worker = workerCount > 0 ? thisWorker() : NULL;
+    Thread host = currentThread;
+    long long start = worker != NULL ? 0 : thread_now();
+    int status;
+
+    thread->state = RUNNING;
+    if (worker != NULL) worker->current = thread;
+    else currentThread = thread;
+    TRACE(TRACE_SWITCH, TRACE_NOBODY, thread->tid);
+    status = step(thread, thread->arg);
+    TRACE(TRACE_SWITCH, thread->tid, TRACE_NOBODY);
+    if (worker != NULL) {
+        worker->current = NULL;
+    } else {
+        currentThread = host;
+        chargeCoroutine(thread, thread_now() - start); // before it is requeued at its level
+    }
+
+    if (status == CO_YIELDED) {
+        thread->state = READY;
+        if (worker != NULL) {
+            dequePush(&worker->ready, thread);
+            notifyWorkers();
+        } else {
+            readyEnqueue(thread);
+        }
+    } else if (status == CO_BLOCKED) {
+        spinUnlock(coroutineParkLock); // from here a waker may requeue it
+    } else {
+        wakeJoiners(thread);
+        TRACE(TRACE_FINISH, thread->tid, 0);
+        thread->state = FINISHED;
+        if (worker != NULL) {
+            retireThread(thread);
+        } else {
+            atomic_fetch_sub(&liveThreads, 1);
+            if (headOfList == thread) headOfList = thread->next != thread ? thread->next : NULL;
+            thread->prev->next = thread->next;
+            thread->next->prev = thread->prev;
+            threadRelease(thread);
+        }
+    }
+}
+
+/*
+ * Returns 1 if flag is set, else parks the coroutine on queue and returns
+ * 0 for its step to return CO_BLOCKED. Whoever sets the flag, under the
+ * queue's guard, wakes it to try again.
+ */
+static int coroutineWait(Thread self, atomic_int *flag, WaitQueue *queue) {
+    if (atomic_load_explicit(flag, memory_order_acquire)) return 1;
+    spinLock(&queue->guard);
+    if (atomic_load_explicit(flag, memory_order_relaxed)) {
+        spinUnlock(&queue->guard);
+        return 1;
+    }
+    TRACE(TRACE_BLOCK, self->tid, 0);
+    waitEnqueue(queue, self);
+    self->state = BLOCKED;
+    coroutineParkLock = &queue->guard;
+    return 0;
+}
+
+/*
+ * Creates a coroutine running step and makes it READY. Its frame is
+ * frameSize bytes, copied from frame unless that is NULL, and zeroed
+ * otherwise, and freed with the coroutine. step is called with the frame
+ * until it returns CO_DONE.
+ */
+ThreadHandle thread_spawn_coroutine(int (*step)(Thread self, void *frame), size_t frameSize, const void *frame) {
+    return spawnCoroutine(step, frameSize, frame, 0);
+}
+
+/*
+ * thread_spawn_coroutine for a coroutine whose result (CO_RETURN) is
+ * kept until it has been joined, like thread_spawn_value's.
+ */
+ThreadHandle thread_spawn_coroutine_value(int (*step)(Thread self, void *frame), size_t frameSize, const void *frame) {
+    return spawnCoroutine(step, frameSize, frame, 1);
+}
+
+static ThreadHandle spawnCoroutine(int (*step)(Thread, void *), size_t frameSize, const void *frame, int returnsValue) {
+    ThreadHandle handle;
+    Thread thread;
+    void *copy;
+
+    if ((copy = frame != NULL ? malloc(frameSize) : calloc(1, frameSize)) == NULL) {
+        perror("allocating coroutine frame");
+        exit(EXIT_FAILURE);
+    }
+    if (frame != NULL) memcpy(copy, frame, frameSize);
+    preempt_disable();
+    pthread_mutex_lock(&runtimeLock);
+    thread = allocThread((void (*)()) step, copy);
+    thread->stackless = 1;
+    thread->returnsValue = returnsValue;
+    if (returnsValue) atomic_init(&thread->refs, 2); // one for its join
+    thread->state = READY;
+    addThread(thread);
+    handle = thread_handle(thread);
+    pthread_mutex_unlock(&runtimeLock);
+    startThread(thread);
+    preempt_enable();
+    return handle;
+}
+
+/*
+ * 1 once thread has finished, its result stored in result unless that is
+ * NULL. Otherwise 0, self having been parked until it finishes, when the
+ * result is stored. result is left alone once the handle is stale, which
+ * it may be by the time self runs again.
+ */
+int thread_co_join(Thread self, ThreadHandle handle, void **result) {
+    Thread thread = threadLookup(handle);
+    int claim;
+
+    if (thread == NULL) return 1;
+    spinLock(&thread->joiners.guard);
+    if (thread->generation != handle >> 32) { // recycled since the lookup
+        spinUnlock(&thread->joiners.guard);
+        return 1;
+    }
+    if (!atomic_load_explicit(&thread->done, memory_order_relaxed)) {
+        TRACE(TRACE_BLOCK, self->tid, 0);
+        self->waitData = result;
+        waitEnqueue(&thread->joiners, self);
+        self->state = BLOCKED;
+        coroutineParkLock = &thread->joiners.guard;
+        return 0;
+    }
+    if (result != NULL) *result = thread->result;
+    claim = thread->returnsValue && !thread->joinClaimed;
+    if (claim) thread->joinClaimed = 1;
+    spinUnlock(&thread->joiners.guard);
+    if (claim) threadRelease(thread);
+    return 1;
+}
+
+/*
+ * 1 once future has been set, its value stored in value unless that is
+ * NULL. Otherwise 0, self having been parked until it is set.
+ */
+int thread_co_await(Thread self, Future *future, void **value) {
+    if (!coroutineWait(self, &future->ready, &future->waiters)) return 0;
+    if (value != NULL) *value = future->value;
+    return 1;
+}
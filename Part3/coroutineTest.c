@@ -0,0 +1,61 @@
+/*
+ ============================================================================
+ Name        : coroutineTest.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Coroutines that never stop yielding must not hold up the
+               rest of the runtime. One spins on CO_YIELD until a thread
+               that slept 10ms sets a flag, another until a thread at the
+               lowest priority sets one. Exits with 0 once both have
+               seen their flag, or is killed after 5 seconds.
+               gcc -O2 coroutineTest.c -o coroutineTest && ./coroutineTest
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "littleThread.h"
+#include "littleThread.c"
+
+volatile int slept, ranLow;
+
+typedef struct {
+    volatile int *flag;
+    long steps;
+} Spin;
+
+int spin(Thread self, void *frame) {
+    Spin *s = frame;
+
+    CO_BEGIN(self);
+    while (!*s->flag) {
+        s->steps++;
+        CO_YIELD(self);
+    }
+    CO_END(self);
+}
+
+void sleeper(void *arg) {
+    thread_sleep(10000000LL);
+    slept = 1;
+}
+
+void low(void *arg) {
+    ranLow = 1;
+}
+
+int main(void) {
+    Spin onSleep = { &slept, 0 }, onLow = { &ranLow, 0 };
+
+    alarm(5); // a hang is a failure
+    threadInit();
+    thread_spawn_coroutine(spin, sizeof(Spin), &onSleep);
+    thread_spawn_coroutine(spin, sizeof(Spin), &onLow);
+    thread_spawn(sleeper, NULL);
+    thread_set_priority(thread_spawn(low, NULL), PRIORITIES - 1);
+    setUpTimer();
+    printf("slept %d, low priority ran %d\n", slept, ranLow);
+    return slept && ranLow ? EXIT_SUCCESS : EXIT_FAILURE;
+}
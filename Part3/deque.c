@@ -0,0 +1,137 @@
+/*
+ ============================================================================
+ Name        : deque.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Lock-free work-stealing deque of threads (Chase-Lev).
+               The owning worker pushes and takes at the bottom, other
+               workers steal from the top. Memory orderings follow Le et
+               al., "Correct and Efficient Work-Stealing for Weak Memory
+               Models" (PPoPP 2013).
+ ============================================================================
+ */
+
+#include <stdatomic.h>
+
+#define DEQUE_INITIAL_SIZE 64 // a power of two
+
+typedef struct dequeArray {
+    long mask; // size - 1
+    struct dequeArray *older; // replaced arrays, freed with the deque
+    _Atomic(Thread) slots[];
+} DequeArray;
+
+typedef struct deque {
+    atomic_long top; // next to steal
+    atomic_long bottom; // next free slot
+    _Atomic(DequeArray *) array;
+} Deque;
+
+static DequeArray *dequeArrayNew(long size) {
+    DequeArray *array;
+
+    if ((array = malloc(sizeof(DequeArray) + sizeof(_Atomic(Thread)) * size)) == NULL) {
+        perror("allocating deque");
+        exit(EXIT_FAILURE);
+    }
+    array->mask = size - 1;
+    array->older = NULL;
+    return array;
+}
+
+void dequeInit(Deque *deque) {
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    atomic_init(&deque->array, dequeArrayNew(DEQUE_INITIAL_SIZE));
+}
+
+/*
+ * Frees the deque's arrays. Only when no worker can still steal from it.
+ */
+void dequeFree(Deque *deque) {
+    DequeArray *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    while (array != NULL) {
+        DequeArray *older = array->older;
+        free(array);
+        array = older;
+    }
+}
+
+/*
+ * Doubles the array. Thieves may still be reading the old one, so it is
+ * kept until the deque is freed.
+ */
+static DequeArray *dequeGrow(Deque *deque, DequeArray *array, long top, long bottom) {
+    DequeArray *bigger = dequeArrayNew((array->mask + 1) * 2);
+    for (long i = top; i < bottom; i++) {
+        atomic_store_explicit(&bigger->slots[i & bigger->mask],
+                atomic_load_explicit(&array->slots[i & array->mask], memory_order_relaxed),
+                memory_order_relaxed);
+    }
+    bigger->older = array;
+    atomic_store_explicit(&deque->array, bigger, memory_order_release);
+    return bigger;
+}
+
+/*
+ * Owner only: adds a thread at the bottom.
+ */
+void dequePush(Deque *deque, Thread thread) {
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    DequeArray *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+
+    if (bottom - top > array->mask) array = dequeGrow(deque, array, top, bottom);
+    atomic_store_explicit(&array->slots[bottom & array->mask], thread, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+/*
+ * Owner only: removes the most recently pushed thread, NULL when empty.
+ */
+Thread dequeTake(Deque *deque) {
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    DequeArray *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    long top;
+    Thread thread = NULL;
+
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    if (top <= bottom) {
+        thread = atomic_load_explicit(&array->slots[bottom & array->mask], memory_order_relaxed);
+        if (top == bottom) { // the last one, race the thieves for it
+            if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                    memory_order_seq_cst, memory_order_relaxed)) {
+                thread = NULL;
+            }
+            atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        }
+    } else {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return thread;
+}
+
+/*
+ * Any worker: removes the oldest thread, NULL when empty or when it lost
+ * a race with another thief or the owner.
+ */
+Thread dequeSteal(Deque *deque) {
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    long bottom;
+    Thread thread = NULL;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top < bottom) {
+        DequeArray *array = atomic_load_explicit(&deque->array, memory_order_acquire);
+        thread = atomic_load_explicit(&array->slots[top & array->mask], memory_order_relaxed);
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                memory_order_seq_cst, memory_order_relaxed)) {
+            return NULL;
+        }
+    }
+    return thread;
+}
@@ -0,0 +1,128 @@
+/*
+ ============================================================================
+ Name        : echoBench.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Loopback echo benchmark for the I/O reactor.
+               A server thread accepts CONNECTIONS connections and spawns
+               a thread to echo each; as many client threads each send
+               MESSAGES messages and wait for every echo. Everything runs
+               as green threads, on one pthread or, with WORKERS=n, on n.
+               gcc -O2 -pthread echoBench.c -o echoBench && ./echoBench
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+
+#include "littleThread.h"
+#include "littleThread.c"
+
+#define CONNECTIONS 2000
+#define MESSAGES 100
+#define MESSAGE_SIZE 64
+
+struct sockaddr_in serverAddress;
+int listener;
+atomic_long roundTrips = 0;
+
+void echoConnection(void *arg) {
+    int fd = (int) (long) arg;
+    char buffer[MESSAGE_SIZE];
+    ssize_t got;
+
+    while ((got = thread_read(fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t sent = 0; sent < got; ) {
+            ssize_t done = thread_write(fd, buffer + sent, got - sent);
+            if (done < 0) {
+                perror("server write");
+                exit(EXIT_FAILURE);
+            }
+            sent += done;
+        }
+    }
+    close(fd);
+}
+
+void server(void *arg) {
+    for (int i = 0; i < CONNECTIONS; i++) {
+        int fd = thread_accept(listener, NULL, NULL);
+        if (fd < 0) {
+            perror("accept");
+            exit(EXIT_FAILURE);
+        }
+        thread_spawn(echoConnection, (void *) (long) fd);
+    }
+    close(listener);
+}
+
+void client(void *arg) {
+    char message[MESSAGE_SIZE], reply[MESSAGE_SIZE];
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+
+    if (fd < 0 || thread_connect(fd, (struct sockaddr *) &serverAddress, sizeof(serverAddress)) < 0) {
+        perror("connect");
+        exit(EXIT_FAILURE);
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    memset(message, 'x', sizeof(message));
+    for (int m = 0; m < MESSAGES; m++) {
+        if (thread_write(fd, message, sizeof(message)) != sizeof(message)) {
+            perror("client write");
+            exit(EXIT_FAILURE);
+        }
+        for (ssize_t got = 0; got < (ssize_t) sizeof(reply); ) {
+            ssize_t done = thread_read(fd, reply + got, sizeof(reply) - got);
+            if (done <= 0) {
+                perror("client read");
+                exit(EXIT_FAILURE);
+            }
+            got += done;
+        }
+        atomic_fetch_add(&roundTrips, 1);
+    }
+    close(fd);
+}
+
+int main(void) {
+    struct rlimit files;
+    socklen_t length = sizeof(serverAddress);
+    int one = 1;
+    double start, seconds;
+
+    getrlimit(RLIMIT_NOFILE, &files); // two fds a connection
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&serverAddress, 0, sizeof(serverAddress));
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, (struct sockaddr *) &serverAddress, sizeof(serverAddress)) < 0
+            || listen(listener, SOMAXCONN) < 0
+            || getsockname(listener, (struct sockaddr *) &serverAddress, &length) < 0
+            || thread_set_nonblocking(listener) < 0) {
+        perror("listening");
+        exit(EXIT_FAILURE);
+    }
+
+    threadInit();
+    thread_spawn(server, NULL);
+    for (int i = 0; i < CONNECTIONS; i++) thread_spawn(client, NULL);
+    start = thread_now();
+    if (getenv("WORKERS") != NULL) threadRunWorkers(atoi(getenv("WORKERS")));
+    else setUpTimer();
+    seconds = (thread_now() - start) / 1e9;
+
+    printf("connections %d, round trips %ld in %.2f s: %.0f round trips/s, %.1f us each\n",
+            CONNECTIONS, atomic_load(&roundTrips), seconds,
+            atomic_load(&roundTrips) / seconds, seconds * 1e6 / atomic_load(&roundTrips));
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,290 @@
+/*
+ ============================================================================
+ Name        : edf.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : The deadline scheduling class, in single mode. A deadline
+               thread has a budget of CPU time in each period and is to
+               get it by the end of the period, its deadline. READY
+               deadline threads run before every best-effort thread,
+               earliest deadline first, so best-effort threads only get
+               the slack, and one that wakes with an earlier deadline than
+               the running thread takes over at once. Admission control
+               keeps the budgets' total share of the CPU within 1, which
+               is what lets EDF meet every deadline.
+               Each thread is a constant bandwidth server: one that uses up
+               its budget is throttled until its deadline, when the budget
+               is refilled for the next period, so an overrunning thread
+               cannot eat into the others' time; one that wakes with more
+               budget left than it could use by its deadline at its rate
+               starts a new period instead. Budgets are charged at
+               switches and on ticks, which come every EDF_TICK while
+               deadline threads exist, so they are enforced to a tick.
+               A deadline thread found running past its deadline, or
+               ending its period's work after it, has missed it.
+               In M:N mode deadlines are ignored, like priorities.
+ ============================================================================
+ */
+
+#define EDF_SCALE (1LL << 20) // the whole CPU, in shares
+#define EDF_TICK 1000000 // ns between ticks while deadline threads exist
+
+static Thread edfHead = NULL; // READY deadline threads, earliest deadline first, linked by readyNext
+static long long edfShares = 0; // admitted budget / period, in EDF_SCALE, under runtimeLock
+static int edfThreads = 0; // admitted and not finished
+static int reschedulePending = 0; // a deadline thread is to take over at preempt_enable
+
+static void edfReplenish(void *arg);
+
+/*
+ * A thread's share of the CPU, rounded up so admission errs safe.
+ */
+static long long edfShare(long long period, long long budget) {
+    return (long long) (((__int128) budget * EDF_SCALE + period - 1) / period);
+}
+
+static void edfNewPeriod(Thread thread, long long start) {
+    thread->dlDeadline = start + thread->dlPeriod;
+    thread->dlRuntime = thread->dlBudget;
+    thread->dlMissed = 0;
+    thread->dlStats.periods++;
+}
+
+/*
+ * Charges a running thread for its time since dlStart, counting a miss if
+ * it has run past its deadline.
+ */
+static void edfCharge(Thread thread, long long now) {
+    long long late = now - thread->dlDeadline;
+
+    if (thread->dlStart == 0) return;
+    thread->dlRuntime -= now - thread->dlStart;
+    thread->dlStart = 0;
+    if (late <= 0 || thread->dlPeriod == 0) return;
+    if (late > thread->dlStats.maxLateness) thread->dlStats.maxLateness = late;
+    if (!thread->dlMissed) {
+        thread->dlMissed = 1;
+        thread->dlStats.misses++;
+        TRACE(TRACE_MISS, thread->tid, 0);
+    }
+}
+
+/*
+ * Takes a thread that has used up its budget off the CPU until its
+ * deadline, READY but in no queue.
+ */
+static void edfThrottle(Thread thread, long long now) {
+    thread->dlStats.overruns++;
+    thread->state = READY;
+    thread_timer_start(&thread->dlTimer, thread->dlDeadline - now, 0, edfReplenish, thread);
+}
+
+static void edfReplenish(void *arg) {
+    Thread thread = arg;
+
+    edfNewPeriod(thread, thread->dlDeadline);
+    thread->dlReleased = 1;
+    readyEnqueue(thread);
+    updateTimer();
+}
+
+/*
+ * readyEnqueue for a deadline thread. Charges it if it was running, then
+ * throttles it if it is out of budget, or starts it a new period if its
+ * deadline has passed or it has more budget left than it could use by
+ * then at its rate (unless it was just given this period), before
+ * putting it in the queue by deadline.
+ */
+static void edfEnqueue(Thread thread) {
+    long long now = thread_now();
+    Thread *link;
+
+    edfCharge(thread, now);
+    if (thread->dlRuntime <= 0 && now < thread->dlDeadline) {
+        edfThrottle(thread, now);
+        return;
+    }
+    if (now >= thread->dlDeadline || (!thread->dlReleased
+            && (__int128) thread->dlRuntime * thread->dlPeriod > (__int128) (thread->dlDeadline - now) * thread->dlBudget)) {
+        edfNewPeriod(thread, now);
+    }
+    thread->dlReleased = 0;
+    for (link = &edfHead; *link != NULL && (*link)->dlDeadline <= thread->dlDeadline; link = &(*link)->readyNext);
+    thread->readyNext = *link;
+    *link = thread;
+    readyCount++;
+    if (currentThread != mainThread && currentThread != thread && currentThread->state == RUNNING
+            && (currentThread->dlPeriod == 0 || thread->dlDeadline < currentThread->dlDeadline)) {
+        reschedulePending = 1;
+        preemptPending = 1; // taken at the next preempt_enable, or now by a tick
+    }
+}
+
+static Thread edfDequeue() {
+    Thread thread = edfHead;
+
+    edfHead = thread->readyNext;
+    readyCount--;
+    return thread;
+}
+
+/*
+ * readyRemove for a deadline thread, which may be throttled instead.
+ */
+static int edfRemove(Thread thread) {
+    Thread *link;
+
+    if (thread_timer_cancel(&thread->dlTimer)) return 1;
+    for (link = &edfHead; *link != NULL && *link != thread; link = &(*link)->readyNext);
+    if (*link == NULL) return 0;
+    *link = thread->readyNext;
+    readyCount--;
+    return 1;
+}
+
+/*
+ * Charges prevThread, if it was running as a deadline thread and has not
+ * been charged, and starts nextThread's clock if it is one.
+ */
+static void edfSwitch(Thread prevThread, Thread nextThread) {
+    long long now = thread_now();
+
+    edfCharge(prevThread, now);
+    if (nextThread->dlPeriod != 0) nextThread->dlStart = now;
+}
+
+/*
+ * On a tick, charges the running deadline thread. Returns 1 if it has
+ * used up its budget and been throttled.
+ */
+static int edfTick(Thread thread) {
+    long long now = thread_now();
+
+    edfCharge(thread, now);
+    thread->dlStart = now;
+    if (thread->dlRuntime > 0) return 0;
+    if (now >= thread->dlDeadline) { // it has its next period's budget at once
+        edfNewPeriod(thread, now);
+        return 0;
+    }
+    thread->dlStart = 0;
+    edfThrottle(thread, now);
+    return 1;
+}
+
+/*
+ * Gives the finishing thread's share of the CPU back.
+ */
+static void edfLeave(Thread thread) {
+    if (thread->dlPeriod == 0) return;
+    pthread_mutex_lock(&runtimeLock);
+    edfShares -= edfShare(thread->dlPeriod, thread->dlBudget);
+    edfThreads--;
+    pthread_mutex_unlock(&runtimeLock);
+    setTickInterval();
+}
+
+/*
+ * Makes thread a deadline thread getting budget ns of CPU every period ns,
+ * its first period starting now, or a best-effort thread if period is 0.
+ * Returns -1, changing nothing, if the budgets of the deadline threads
+ * would then add up to more than the CPU, or budget is not within period,
+ * or thread is stale or a coroutine.
+ */
+int thread_set_deadline(ThreadHandle handle, long long period, long long budget) {
+    Thread thread = threadLookup(handle);
+    long long share = period != 0 ? edfShare(period, budget) : 0;
+    int queued, admitted = 1;
+
+    if (thread == NULL || thread->stackless) return -1;
+    if (period != 0 && (period < 0 || budget <= 0 || budget > period)) return -1;
+    preempt_disable();
+    pthread_mutex_lock(&runtimeLock);
+    if (thread->generation != handle >> 32 || thread->state == FINISHED) {
+        admitted = 0;
+    } else {
+        long long shares = edfShares + share - (thread->dlPeriod != 0 ? edfShare(thread->dlPeriod, thread->dlBudget) : 0);
+        if (shares > EDF_SCALE) {
+            admitted = 0;
+        } else {
+            edfThreads += (period != 0) - (thread->dlPeriod != 0);
+            edfShares = shares;
+        }
+    }
+    pthread_mutex_unlock(&runtimeLock);
+    if (!admitted) {
+        preempt_enable();
+        return -1;
+    }
+    queued = thread->state == READY && workerCount == 0 && readyRemove(thread);
+    if (thread == currentThread && thread->dlStart != 0) edfCharge(thread, thread_now());
+    thread->dlPeriod = period;
+    thread->dlBudget = budget;
+    thread->dlReleased = 0;
+    if (period != 0) {
+        edfNewPeriod(thread, thread_now());
+        thread->dlReleased = 1;
+        if (thread == currentThread) thread->dlStart = thread_now();
+    }
+    if (queued) readyEnqueue(thread);
+    setTickInterval();
+    preempt_enable();
+    return 0;
+}
+
+/*
+ * Ends the running deadline thread's work for this period: it sleeps
+ * until the next one starts, at its deadline, or carries on into it at
+ * once if the deadline has passed, which is a miss. Just yields for a
+ * best-effort thread.
+ */
+void thread_deadline_yield() {
+    Thread self = thread_self();
+    long long now, release;
+
+    if (self == NULL || self->dlPeriod == 0 || workerCount > 0) {
+        threadYield();
+        return;
+    }
+    preempt_disable();
+    now = thread_now();
+    edfCharge(self, now);
+    self->dlStart = now;
+    release = self->dlDeadline > now ? self->dlDeadline : now;
+    edfNewPeriod(self, release);
+    self->dlReleased = 1;
+    preempt_enable();
+    thread_sleep_until(release);
+}
+
+/*
+ * Copies a thread's deadline stats, kept until it is recycled.
+ */
+int thread_deadline_stats(ThreadHandle handle, DeadlineStats *stats) {
+    Thread thread = threadLookup(handle);
+
+    if (thread == NULL) return -1;
+    *stats = thread->dlStats;
+    return thread->generation == handle >> 32 ? 0 : -1;
+}
+
+/*
+ * Prints each deadline thread's period, budget and stats, and the share
+ * of the CPU admitted.
+ */
+void thread_deadline_report() {
+    printf("Thread Deadlines\n");
+    printf("================\n");
+    preempt_disable();
+    pthread_mutex_lock(&runtimeLock);
+    for (int i = 0; i < threadCount; i++) {
+        Thread thread = threadAt(i);
+        if (thread->dlPeriod == 0) continue;
+        printf("threadID: %d period: %lld budget: %lld periods: %lld misses: %lld overruns: %lld max lateness: %lld\n",
+                thread->tid, thread->dlPeriod, thread->dlBudget, thread->dlStats.periods,
+                thread->dlStats.misses, thread->dlStats.overruns, thread->dlStats.maxLateness);
+    }
+    printf("admitted %.1f%% of the CPU\n", 100.0 * edfShares / EDF_SCALE);
+    pthread_mutex_unlock(&runtimeLock);
+    preempt_enable();
+}
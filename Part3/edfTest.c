@@ -0,0 +1,89 @@
+/*
+ ============================================================================
+ Name        : edfTest.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Deadline scheduling. A control thread needing 0.3ms of
+               every 5ms (budget 1ms) runs PERIODS periods next to three
+               CPU-bound best-effort threads and a deadline thread that
+               would use the whole CPU but is given 2ms of every 10ms. A
+               third deadline thread would overcommit the CPU, and one
+               with a budget over its period is nonsense; both must be
+               rejected. The control thread must start its periods within
+               MAX_LATE of their release and not miss their deadlines, but
+               for at most one in twenty, which the machine's other load
+               can account for, and the hog must have been throttled.
+               Exits with 0 if so.
+               gcc -O2 edfTest.c -o edfTest && ./edfTest
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "littleThread.h"
+#include "littleThread.c"
+
+#define PERIODS 200
+#define PERIOD 5000000LL
+#define MAX_LATE 2500000LL // half a period
+
+volatile int stop;
+long long maxLate;
+int latePeriods;
+int failed;
+ThreadHandle hogger;
+DeadlineStats controlStats, hogStats; // taken before the threads finish, when their handles go stale
+
+void spin(long long ns) {
+    long long end = thread_now() + ns;
+    while (thread_now() < end);
+}
+
+void batch(void *arg) {
+    while (!stop);
+}
+
+void hog(void *arg) {
+    while (!stop) spin(100000);
+}
+
+void control(void *arg) {
+    long long release;
+
+    if (thread_set_deadline(thread_handle(thread_self()), PERIOD, 1000000) != 0) {
+        printf("control not admitted\n");
+        failed = 1;
+    }
+    release = thread_now();
+    for (int i = 0; i < PERIODS; i++) {
+        long long late = thread_now() - release;
+        if (late > maxLate) maxLate = late;
+        if (late > MAX_LATE) latePeriods++;
+        spin(300000);
+        release = thread_self()->dlDeadline; // the next period starts where this one ends
+        thread_deadline_yield();
+    }
+    thread_deadline_stats(thread_handle(thread_self()), &controlStats);
+    thread_deadline_stats(hogger, &hogStats);
+    stop = 1;
+}
+
+int main(void) {
+    ThreadHandle extra;
+
+    threadInit();
+    for (int i = 0; i < 3; i++) thread_spawn(batch, NULL);
+    thread_spawn(control, NULL);
+    hogger = thread_spawn(hog, NULL);
+    extra = thread_spawn(hog, NULL);
+    if (thread_set_deadline(hogger, 10000000, 2000000) != 0) failed = 1;
+    if (thread_set_deadline(extra, 10000000, 9000000) != -1) failed = 1; // overcommits
+    if (thread_set_deadline(extra, 1000, 2000) != -1) failed = 1; // budget over the period
+    if (failed) printf("admission control wrong\n");
+    setUpTimer();
+    printf("control: %d of %d periods late, at most %.3f ms, %lld misses; hog: %lld overruns\n",
+            latePeriods, PERIODS, maxLate / 1e6, controlStats.misses, hogStats.overruns);
+    if (latePeriods + controlStats.misses > PERIODS / 20 || hogStats.overruns == 0) failed = 1;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
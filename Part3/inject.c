@@ -0,0 +1,148 @@
+/*
+ ============================================================================
+ Name        : inject.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Injection from outside the runtime. Pthreads it does not
+               run, and signal handlers, hand it requests (spawn a thread,
+               wake a parked one) on a lock-free queue: a producer pushes
+               with one compare-and-swap, and the runtime takes the whole
+               queue with one exchange and handles it oldest first.
+               The push that finds the queue empty wakes the runtime: in
+               single mode a tick signal to its pthread, which preempts the
+               running thread or ends the idle loop's sleep; in M:N mode
+               the workers' futex, and the eventfd of one blocked in epoll,
+               or if none is parked, a tick signal to worker 0.
+               Pushes onto a queue already waiting only wait with it, so
+               a burst of them costs one wakeup. The queue is drained on
+               ticks and by the idle loop, and by workers on every pass.
+               thread_park/thread_unpark carry a permit, so an unpark that
+               comes before the park is not lost. A parked thread's queue
+               node is in its control block, so unparking never allocates.
+ ============================================================================
+ */
+
+#define PARK_NONE 0
+#define PARK_PERMIT 1 // unparked since it last parked
+#define PARK_PARKED 2
+
+static _Atomic(Injection *) injectHead = NULL; // the newest request, linked by next
+static pthread_t injectPthread; // running setUpTimer, or worker 0
+static atomic_int injectListening = 0; // the runtime is running, signal injectPthread
+
+/*
+ * Pushes a request, waking the runtime if it is the first. Async-signal-safe.
+ */
+static void injectPush(Injection *node) {
+    Injection *head = atomic_load_explicit(&injectHead, memory_order_relaxed);
+
+    do {
+        node->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&injectHead, &head, node,
+            memory_order_seq_cst, memory_order_relaxed));
+    if (head != NULL) return; // the runtime has been woken for the ones before
+    if (workerCount > 0) notifyWorkers();
+    if (atomic_load(&injectListening) && (workerCount == 0 || atomic_load(&parkedWorkers) == 0)) {
+        pthread_kill(injectPthread, SIGVTALRM); // every worker is busy, preempt worker 0
+    }
+}
+
+/*
+ * Starts (on) or stops sending the tick signal to the calling pthread for
+ * requests, which then drains the queue: setUpTimer's, or worker 0's
+ * while no worker is parked to be woken instead.
+ */
+static void injectListen(int on) {
+    if (on) injectPthread = pthread_self();
+    atomic_store(&injectListening, on);
+}
+
+/*
+ * Whether requests are waiting, for the idle loop and parking workers to
+ * check after they have made sure they will be woken for new ones.
+ */
+static int injectPending() {
+    return atomic_load(&injectHead) != NULL;
+}
+
+/*
+ * Handles every request pushed so far, in the order they were pushed.
+ * Preemption must be disabled. Costs a load when there are none.
+ */
+static void injectDrain() {
+    Injection *node, *oldest = NULL;
+
+    if (atomic_load_explicit(&injectHead, memory_order_relaxed) == NULL) return;
+    node = atomic_exchange_explicit(&injectHead, NULL, memory_order_acquire);
+    while (node != NULL) { // reverse it, before anything can be pushed again
+        Injection *next = node->next;
+        node->next = oldest;
+        oldest = node;
+        node = next;
+    }
+    while ((node = oldest) != NULL) {
+        oldest = node->next;
+        if (node->fn != NULL) {
+            thread_spawn(node->fn, node->arg);
+            atomic_fetch_sub(&liveThreads, 1); // counted while it was queued
+            free(node);
+        } else {
+            Thread thread = node->arg;
+            spinLock(&thread->parkGuard); // released once it is switched out
+            spinUnlock(&thread->parkGuard);
+            atomic_store(&thread->parkState, PARK_NONE); // the wake takes the permit
+            threadWake(thread);
+        }
+    }
+}
+
+/*
+ * Spawns a thread running fn(arg) the next time the runtime drains the
+ * queue, or when it next runs. Returns -1 if out of memory.
+ * The runtime does not finish while the request is queued.
+ */
+int thread_inject_spawn(void (*fn)(), void *arg) {
+    Injection *node = malloc(sizeof(Injection));
+
+    if (node == NULL) return -1;
+    node->fn = fn;
+    node->arg = arg;
+    atomic_fetch_add(&liveThreads, 1);
+    injectPush(node);
+    return 0;
+}
+
+/*
+ * Blocks the running thread until thread_unpark, returning at once if it
+ * has been unparked since it last parked. May return early, so wait in a
+ * loop on the condition. Threads only.
+ */
+void thread_park() {
+    Thread self = thread_self();
+    int expected = PARK_NONE;
+
+    if (self == NULL || self == mainThread) return;
+    preempt_disable();
+    spinLock(&self->parkGuard);
+    if (atomic_compare_exchange_strong(&self->parkState, &expected, PARK_PARKED)) {
+        threadPark(&self->parkGuard);
+    } else { // take the permit
+        atomic_store(&self->parkState, PARK_NONE);
+        spinUnlock(&self->parkGuard);
+    }
+    preempt_enable();
+}
+
+/*
+ * Wakes a thread in thread_park, or makes its next one return at once.
+ * From any pthread or signal handler. A stale handle is ignored, though a
+ * handle going stale meanwhile may unpark the slot's next thread early.
+ */
+void thread_unpark(ThreadHandle handle) {
+    Thread thread = threadLookup(handle);
+
+    if (thread == NULL) return;
+    if (atomic_exchange(&thread->parkState, PARK_PERMIT) == PARK_PARKED) {
+        injectPush(&thread->unparkNode);
+    }
+}
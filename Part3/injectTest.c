@@ -0,0 +1,129 @@
+/*
+ ============================================================================
+ Name        : injectTest.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Injection from outside the runtime. PRODUCERS pthreads
+               each post ROUNDS times to their share of WAITERS parked
+               threads, unparking them, then spawn SPAWNS threads into
+               the runtime, while a CPU-bound thread keeps it busy; every
+               post must be seen, a lost wakeup leaving a waiter parked,
+               and every thread run. Then a SIGALRM
+               handler unparks a thread every millisecond, and it must
+               see TICKS of them. Exits with 0 if all is well, or is
+               killed after 20 seconds. With an argument, runs on that
+               many workers.
+               gcc -O2 injectTest.c -o injectTest && ./injectTest [workers]
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "littleThread.h"
+#include "littleThread.c"
+
+#define WAITERS 8
+#define ROUNDS 20000
+#define PRODUCERS 4
+#define SPAWNS 5000
+#define TICKS 200
+
+atomic_int posted[WAITERS];
+int seen[WAITERS];
+atomic_int spawned, producersDone, ticks;
+ThreadHandle waiters[WAITERS], keeperThread, ticked;
+volatile int stop, got;
+volatile long sink;
+
+void counter(void *arg) {
+    atomic_fetch_add(&spawned, 1);
+}
+
+void waiter(void *arg) {
+    long self = (long) arg;
+
+    while (seen[self] < ROUNDS) {
+        while (atomic_load(&posted[self]) == seen[self]) thread_park();
+        seen[self] = atomic_load(&posted[self]); // all posted since it last looked
+    }
+}
+
+void keeper(void *arg) {
+    while (atomic_load(&producersDone) < PRODUCERS) thread_park();
+    stop = 1;
+}
+
+void hog(void *arg) {
+    while (!stop) sink++;
+}
+
+void *producer(void *arg) {
+    long first = (long) arg;
+
+    for (int r = 0; r < ROUNDS; r++) {
+        for (long i = first; i < WAITERS; i += PRODUCERS) {
+            atomic_fetch_add(&posted[i], 1);
+            thread_unpark(waiters[i]);
+        }
+    }
+    for (int s = 0; s < SPAWNS; s++) thread_inject_spawn(counter, NULL);
+    atomic_fetch_add(&producersDone, 1);
+    thread_unpark(keeperThread);
+    return NULL;
+}
+
+void onAlarm(int signum) {
+    if (atomic_fetch_add(&ticks, 1) > 20000) _exit(EXIT_FAILURE); // replaces alarm(20)
+    thread_unpark(ticked);
+}
+
+void tickWaiter(void *arg) {
+    while (got < TICKS) {
+        while (atomic_load(&ticks) == got) thread_park();
+        got = atomic_load(&ticks);
+    }
+    stop = 1;
+}
+
+void run(int workerThreads) {
+    if (workerThreads > 0) threadRunWorkers(workerThreads);
+    else setUpTimer();
+}
+
+int main(int argc, char **argv) {
+    int workerThreads = argc > 1 ? atoi(argv[1]) : 0;
+    struct itimerval interval = { { 0, 1000 }, { 0, 1000 } }, off = { { 0, 0 }, { 0, 0 } };
+    pthread_t producers[PRODUCERS];
+    long total = 0;
+    int failed = 0;
+
+    alarm(20); // a lost wakeup hangs
+    threadInit();
+    for (long i = 0; i < WAITERS; i++) waiters[i] = thread_spawn(waiter, (void *) i);
+    keeperThread = thread_spawn(keeper, NULL);
+    thread_spawn(hog, NULL);
+    for (long p = 0; p < PRODUCERS; p++) {
+        if (pthread_create(&producers[p], NULL, producer, (void *) p) != 0) {
+            perror("creating producer");
+            exit(EXIT_FAILURE);
+        }
+    }
+    run(workerThreads);
+    for (int p = 0; p < PRODUCERS; p++) pthread_join(producers[p], NULL);
+    for (int i = 0; i < WAITERS; i++) total += seen[i];
+    printf("posts seen %ld (want %d), threads spawned %d (want %d)\n",
+            total, WAITERS * ROUNDS, atomic_load(&spawned), PRODUCERS * SPAWNS);
+    if (total != WAITERS * ROUNDS || atomic_load(&spawned) != PRODUCERS * SPAWNS) failed = 1;
+
+    stop = 0;
+    ticked = thread_spawn(tickWaiter, NULL);
+    thread_spawn(hog, NULL);
+    signal(SIGALRM, onAlarm);
+    setitimer(ITIMER_REAL, &interval, NULL);
+    run(workerThreads);
+    setitimer(ITIMER_REAL, &off, NULL);
+    printf("ticks seen %d (want %d)\n", got, TICKS);
+    if (got < TICKS) failed = 1;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
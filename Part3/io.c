@@ -0,0 +1,263 @@
+/*
+ ============================================================================
+ Name        : io.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : I/O reactor. The wrappers try the call on a non-blocking fd
+               and, when it would block, register the thread for the fd
+               with epoll and park it (BLOCKED). Registrations are one-shot
+               and re-armed while threads still wait. Any number of
+               threads may wait on an fd, readers and writers each in
+               their own queue, first come first woken: readiness wakes
+               the first of the queue, and the registration re-armed for
+               the rest fires again if the fd is still ready once it has
+               had its turn; a hangup or error wakes them all.
+               The epoll set is polled, and the ready threads woken, on each
+               preemption tick and by the idle loop, which blocks in it. In
+               M:N mode workers poll when they run out of work, and one
+               parking worker blocks in epoll instead of on the futex; an
+               eventfd in the set wakes it when work is pushed.
+ ============================================================================
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define IO_EVENTS 256 // taken per epoll_wait
+
+/* The threads waiting for an fd, their queues' guards unused (ioLock) */
+typedef struct ioFd {
+    WaitQueue readers; // waiting for EPOLLIN
+    WaitQueue writers; // waiting for EPOLLOUT
+    int registered; // in the epoll set, disarmed or not
+} IoFd;
+
+static int epollFd = -1;
+static int ioEventFd = -1; // written to wake a worker blocked in epoll
+static IoFd *ioFds = NULL; // indexed by fd
+static int ioFdCount = 0;
+static atomic_int ioWaiters = 0; // threads parked on an fd
+static atomic_int ioPolling = 0; // a parked worker is blocked in epoll
+static atomic_int ioLock = 0; // the fd table and epoll_ctl, held with preemption disabled
+
+/*
+ * Creates the epoll set the first time a thread has to wait.
+ */
+static void ioInit() {
+    struct epoll_event event;
+
+    if ((epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        perror("creating epoll set");
+        exit(EXIT_FAILURE);
+    }
+    if ((ioEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        perror("creating eventfd");
+        exit(EXIT_FAILURE);
+    }
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = ioEventFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, ioEventFd, &event);
+}
+
+/*
+ * The table entry of fd, growing the table to fit. The lock must be held.
+ */
+static IoFd *ioEntry(int fd) {
+    if (fd >= ioFdCount) {
+        int count = ioFdCount ? ioFdCount : 64;
+        while (count <= fd) count *= 2;
+        if ((ioFds = realloc(ioFds, sizeof(IoFd) * count)) == NULL) {
+            perror("allocating fd table");
+            exit(EXIT_FAILURE);
+        }
+        memset(ioFds + ioFdCount, 0, sizeof(IoFd) * (count - ioFdCount));
+        ioFdCount = count;
+    }
+    return &ioFds[fd];
+}
+
+/*
+ * Arms the one-shot registration of fd for whoever is waiting on it.
+ * A closed fd leaves the set by itself, so a registered one may be gone.
+ */
+static void ioArm(int fd, IoFd *entry) {
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLONESHOT | EPOLLRDHUP
+            | (entry->readers.head != NULL ? EPOLLIN : 0) | (entry->writers.head != NULL ? EPOLLOUT : 0);
+    event.data.fd = fd;
+    if (entry->registered && epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) == 0) return;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        perror("registering fd");
+        exit(EXIT_FAILURE);
+    }
+    entry->registered = 1;
+}
+
+/*
+ * Parks the running thread until fd is ready for events (EPOLLIN or EPOLLOUT).
+ * It parks on the lock, so the poller cannot wake it before it is switched out.
+ */
+static void ioWait(int fd, unsigned int events) {
+    IoFd *entry;
+
+    preempt_disable();
+    spinLock(&ioLock);
+    if (epollFd < 0) ioInit();
+    entry = ioEntry(fd);
+    waitEnqueue(events & EPOLLIN ? &entry->readers : &entry->writers, thread_self());
+    ioArm(fd, entry);
+    atomic_fetch_add(&ioWaiters, 1);
+    if (workerCount == 0 && currentThread != mainThread) updateTimer(); // ticks to poll on
+    threadPark(&ioLock);
+    preempt_enable();
+}
+
+/*
+ * Moves the first waiter of queue, or all of them, to woken, returning
+ * how many. The lock must be held.
+ */
+static int ioTake(WaitQueue *queue, int all, WaitQueue *woken) {
+    Thread thread;
+    int taken = 0;
+
+    while ((thread = waitDequeue(queue)) != NULL) {
+        waitEnqueue(woken, thread);
+        taken++;
+        if (!all) break;
+    }
+    return taken;
+}
+
+/*
+ * Wakes the threads whose fds are ready, waiting up to timeout ms (-1 for
+ * ever) with sigmask, if not NULL, as the signal mask meanwhile.
+ * Preemption must be disabled. Returns the number of threads woken,
+ * costs a load when none is waiting.
+ */
+static int ioPoll(int timeout, const sigset_t *sigmask) {
+    struct epoll_event events[IO_EVENTS];
+    int count, woken = 0;
+
+    if (atomic_load_explicit(&ioWaiters, memory_order_relaxed) == 0) return 0;
+    count = epoll_pwait(epollFd, events, IO_EVENTS, timeout, sigmask);
+    for (int i = 0; i < count; i++) {
+        int fd = events[i].data.fd;
+        unsigned int ready = events[i].events;
+        int failed = ready & (EPOLLHUP | EPOLLERR); // every waiter will see it
+        WaitQueue wake = { 0 };
+        IoFd *entry;
+        Thread thread;
+        int taken = 0;
+
+        if (fd == ioEventFd) { // only there to wake us
+            eventfd_t value;
+            eventfd_read(ioEventFd, &value);
+            continue;
+        }
+        spinLock(&ioLock);
+        entry = &ioFds[fd];
+        if (ready & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            taken += ioTake(&entry->readers, failed || (ready & EPOLLRDHUP), &wake);
+        }
+        if (ready & (EPOLLOUT | EPOLLHUP | EPOLLERR)) taken += ioTake(&entry->writers, failed, &wake);
+        if (entry->readers.head != NULL || entry->writers.head != NULL) ioArm(fd, entry); // others still wait
+        atomic_fetch_sub(&ioWaiters, taken);
+        spinUnlock(&ioLock);
+        while ((thread = waitDequeue(&wake)) != NULL) threadWake(thread);
+        woken += taken;
+    }
+    return woken;
+}
+
+/*
+ * Called by a worker with nothing to run: blocks in epoll, rather than on
+ * the futex, if threads wait for I/O and no other worker is already doing
+ * so. Returns 0 if it did not. A push after sequence was read interrupts
+ * the wait through ioInterrupt().
+ */
+static int ioPark(unsigned int sequence, struct timespec *timeout) {
+    int expected = 0;
+    int ms = -1;
+
+    if (atomic_load(&ioWaiters) == 0) return 0;
+    if (!atomic_compare_exchange_strong(&ioPolling, &expected, 1)) return 0;
+    if (timeout != NULL) ms = timeout->tv_sec * 1000 + (timeout->tv_nsec + 999999) / 1000000;
+    if (atomic_load(&workSequence) == sequence) ioPoll(ms, NULL);
+    atomic_store(&ioPolling, 0);
+    return 1;
+}
+
+/*
+ * Wakes the worker blocked in epoll, if there is one.
+ */
+static void ioInterrupt() {
+    if (atomic_load(&ioPolling)) eventfd_write(ioEventFd, 1);
+}
+
+/*
+ * Makes fd non-blocking, which the wrappers need. Returns -1 on error.
+ */
+int thread_set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0) return -1;
+    return flags & O_NONBLOCK ? 0 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+ssize_t thread_read(int fd, void *buf, size_t count) {
+    for (;;) {
+        ssize_t done = read(fd, buf, count);
+        if (done >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return done;
+        ioWait(fd, EPOLLIN);
+    }
+}
+
+ssize_t thread_write(int fd, const void *buf, size_t count) {
+    for (;;) {
+        ssize_t done = write(fd, buf, count);
+        if (done >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return done;
+        ioWait(fd, EPOLLOUT);
+    }
+}
+
+/*
+ * The accepted socket is non-blocking.
+ */
+int thread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+    for (;;) {
+        int accepted = accept(fd, addr, addrlen);
+        if (accepted >= 0) {
+            if (thread_set_nonblocking(accepted) < 0) {
+                close(accepted);
+                return -1;
+            }
+            return accepted;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+        ioWait(fd, EPOLLIN);
+    }
+}
+
+/*
+ * Makes fd non-blocking and connects it, parking until the connection is
+ * made or has failed.
+ */
+int thread_connect(int fd, const struct sockaddr *addr, socklen_t addrlen) {
+    int error;
+    socklen_t length = sizeof(error);
+
+    if (thread_set_nonblocking(fd) < 0) return -1;
+    if (connect(fd, addr, addrlen) == 0) return 0;
+    if (errno != EINPROGRESS) return -1;
+    ioWait(fd, EPOLLOUT);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0) return -1;
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
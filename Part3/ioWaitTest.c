@@ -0,0 +1,57 @@
+/*
+ ============================================================================
+ Name        : ioWaitTest.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Several threads waiting on the same fd must all be woken
+               in turn. READERS threads read one byte each from one pipe
+               and another writes the bytes a millisecond apart, once they
+               are all waiting; then the pipe is closed under readers
+               waiting for more, who must all see the end of it. Exits
+               with 0 if every reader got its byte and its end of file, or
+               is killed after 5 seconds.
+               gcc -O2 ioWaitTest.c -o ioWaitTest && ./ioWaitTest
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "littleThread.h"
+#include "littleThread.c"
+
+#define READERS 4
+
+int pipeFds[2];
+int gotByte, gotEnd;
+
+void reader(void *arg) {
+    char c;
+
+    if (thread_read(pipeFds[0], &c, 1) == 1) gotByte++;
+    if (thread_read(pipeFds[0], &c, 1) == 0) gotEnd++;
+}
+
+void writer(void *arg) {
+    thread_sleep(10000000LL); // the readers are all waiting by now
+    for (int i = 0; i < READERS; i++) {
+        thread_write(pipeFds[1], "x", 1);
+        thread_sleep(1000000LL);
+    }
+    close(pipeFds[1]);
+}
+
+int main(void) {
+    alarm(5); // a hang is a failure
+    if (pipe(pipeFds) < 0 || thread_set_nonblocking(pipeFds[0]) < 0 || thread_set_nonblocking(pipeFds[1]) < 0) {
+        perror("making pipe");
+        exit(EXIT_FAILURE);
+    }
+    threadInit();
+    for (int i = 0; i < READERS; i++) thread_spawn(reader, NULL);
+    thread_spawn(writer, NULL);
+    setUpTimer();
+    printf("%d of %d readers got a byte, %d the end\n", gotByte, READERS, gotEnd);
+    return gotByte == READERS && gotEnd == READERS ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,78 @@
+/*
+ ============================================================================
+ Name        : joinTest.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : thread_join, thread_exit and futures. A thread spawns
+               CHILDREN threads returning the square of their argument and
+               joins them, adding up the results, and joins one that ends
+               with thread_exit; joining itself must fail. Then WAITERS
+               threads wait on a future it sets, and setting it twice
+               must fail. Exits with 0 if all is well. With an argument,
+               runs on that many workers.
+               gcc -O2 joinTest.c -o joinTest && ./joinTest [workers]
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "littleThread.h"
+#include "littleThread.c"
+
+#define CHILDREN 2000
+#define WAITERS 100
+
+ThreadHandle children[CHILDREN];
+Future future;
+atomic_long futureSum;
+int failed;
+
+void *square(void *arg) {
+    long x = (long) arg;
+
+    threadYield(); // so the joins find some still running
+    return (void *) (x * x);
+}
+
+void *exiter(void *arg) {
+    thread_exit((void *) 42L);
+    failed = 1; // not reached
+    return NULL;
+}
+
+void waiter(void *arg) {
+    atomic_fetch_add(&futureSum, (long) thread_future_get(&future));
+}
+
+void parent(void *arg) {
+    ThreadHandle exited;
+    long total = 0, want = (long) (CHILDREN - 1) * CHILDREN * (2L * CHILDREN - 1) / 6;
+    void *result;
+
+    for (long i = 0; i < CHILDREN; i++) children[i] = thread_spawn_value(square, (void *) i);
+    exited = thread_spawn_value(exiter, NULL);
+    for (int i = 0; i < CHILDREN; i++) {
+        thread_join(children[i], &result);
+        total += (long) result;
+    }
+    thread_join(exited, &result);
+    printf("joined %ld (want %ld), exit value %ld\n", total, want, (long) result);
+    if (total != want || (long) result != 42) failed = 1;
+    if (thread_join(thread_handle(thread_self()), NULL) != -1) failed = 1;
+    for (int i = 0; i < WAITERS; i++) thread_spawn(waiter, NULL);
+    threadYield();
+    thread_future_set(&future, (void *) 3L);
+    if (thread_future_set(&future, (void *) 4L) != -1) failed = 1;
+}
+
+int main(int argc, char **argv) {
+    threadInit();
+    thread_future_init(&future);
+    thread_spawn(parent, NULL);
+    if (argc > 1) threadRunWorkers(atoi(argv[1]));
+    else setUpTimer();
+    printf("future sum %ld (want %d)\n", atomic_load(&futureSum), 3 * WAITERS);
+    if (atomic_load(&futureSum) != 3 * WAITERS) failed = 1;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
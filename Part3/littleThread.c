@@ -0,0 +1,1121 @@
+/*
+ ============================================================================
+ Name        : littleThread.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : The thread runtime: scheduler, switcher and thread creation.
+               Included by the drivers (OSA1.3.c) and the benchmarks.
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <time.h>
+#include <memory.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "littleThread.h"
+#include "context.c"
+#include "stackPool.c"
+#include "deque.c"
+
+Thread newThread; // the thread currently being set up
+Thread mainThread; // the main thread
+atomic_int threadCount = 0; // slots of the thread table ever used (threadTable.c)
+
+#define PRIORITIES 4 // levels of the feedback queue
+#define BOOST_INTERVAL 1000000000LL // ns between priority boosts
+#define ADAPT_FACTOR 4 // the slice grows, and the tick shrinks, by this as the runnable threads change
+#define MIN_QUANTUM 1000 // ns
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+static struct thread controller; // the main thread's control block
+static Thread headOfList = NULL; // first thread of the circular linked list
+static sigset_t preemptSignals; // SIGVTALRM, blocked while the idle loop sleeps
+__thread volatile int preemptDepth = 0; // preempt_disable nesting of the running thread
+__thread volatile int preemptPending = 0; // a tick came while preemption was disabled
+static pthread_mutex_t runtimeLock = PTHREAD_MUTEX_INITIALIZER; // the list, thread table and stack pool in M:N mode
+static atomic_int liveThreads = 0; // spawned and not yet finished
+
+static Thread currentThread = NULL;
+static int ticksPerQuantum = 1; // ticks come faster than the slice while threads wait to get in
+static int subTicks = 0; // ticks since the last one that counted for the slice
+static int readyCount = 0; // threads in the ready queues
+static int readyCoroutines = 0; // of them coroutines, bar deadline ones
+static __thread timer_t tickTimer; // the calling pthread's preemption timer, each worker has its own
+static __thread int timerArmed = 0;
+static __thread long long tickLength = 0; // ns between the calling pthread's ticks
+static Thread deadThread = NULL; // a finished thread, its stack released once we are off it
+static int stackWatch = 0; // record each thread's stack high-water mark when it finishes
+static size_t deepestStack = 0; // the highest mark recorded
+struct sigaction setUpAction;
+
+struct sigaction timerAction;
+static long long quantum = 20000000; // the base time slice, in ns
+static long long sliceLength = 20000000; // the time slice now, quantum adapted to the runnable threads
+static int adaptiveQuantum = 1;
+
+void printThreadStates();
+void scheduler(Thread origThread);
+void switcher(Thread prevThread, Thread nextThread);
+void startTimer();
+void stopTimer();
+void readyEnqueue(Thread thread);
+Thread readyDequeue();
+void threadPark(atomic_int *lock);
+void threadWake(Thread thread);
+void threadWakeSwitch(Thread thread);
+static void updateTimer();
+static void settleTimer();
+static void setTickInterval();
+static void setTimer(int on);
+static void startTicking();
+static void spinLock(atomic_int *lock);
+static void spinUnlock(atomic_int *lock);
+static void runTimers();
+static int nextTimerTimeout(struct timespec *timeout);
+static int ioPoll(int timeout, const sigset_t *sigmask);
+static int ioPark(unsigned int sequence, struct timespec *timeout);
+static void ioInterrupt();
+static ThreadHandle spawnThread(void (*fn)(), void *arg, size_t stackSize, int returnsValue);
+static Thread allocThread(void (startFunc)(), void *arg);
+static void addThread(Thread thread);
+static void startThread(Thread thread);
+static void startThreads(Thread first, int count);
+void threadFinish(Thread thread);
+static void wakeJoiners(Thread thread);
+static void recordStackHighWater(Thread thread);
+static void runCoroutine(Thread thread);
+static void chargeCoroutine(Thread thread, long long ran);
+static int readyRemove(Thread thread);
+static void edfEnqueue(Thread thread);
+static Thread edfDequeue();
+static int edfRemove(Thread thread);
+static void edfSwitch(Thread prevThread, Thread nextThread);
+static int edfTick(Thread thread);
+static void edfLeave(Thread thread);
+static void injectDrain();
+static void injectListen(int on);
+static int injectPending();
+
+#include "threadTable.c"
+#include "trace.c"
+#include "workers.c"
+#include "sync.c"
+#include "channel.c"
+#include "locals.c"
+#include "coroutine.c"
+#include "timers.c"
+#include "io.c"
+#include "edf.c"
+#include "inject.c"
+#include "offload.c"
+#include "policy.c"
+
+/*
+ * Returns the stack of the last finished thread to the pool, and its
+ * control block to the table unless a join is still to take its result.
+ * Called by whichever thread runs next, as a thread cannot give away
+ * the stack it is still running on.
+ */
+void reapDeadStack(){
+    Thread thread = deadThread;
+    if(thread != NULL){
+        deadThread = NULL;
+        stackRelease(thread->stackAddr, thread->stackSize);
+        thread->stackAddr = NULL;
+        threadRelease(thread);
+    }
+}
+
+/*
+ * Hands a READY thread to the policy (policy.c), or a deadline thread to
+ * their queue (edf.c).
+ */
+void readyEnqueue(Thread thread){
+    if(thread->dlPeriod != 0){
+        edfEnqueue(thread);
+        return;
+    }
+    policy->enqueue(thread);
+    readyCount++;
+    readyCoroutines += thread->stackless;
+}
+
+/*
+ * Removes the deadline thread with the earliest deadline or else the
+ * thread the policy picks, NULL if none is READY.
+ */
+Thread readyDequeue(){
+    Thread thread;
+    if(edfHead != NULL) return edfDequeue();
+    if((thread = policy->dequeue()) != NULL){
+        readyCount--;
+        readyCoroutines -= thread->stackless;
+    }
+    return thread;
+}
+
+/*
+ * Takes a thread out of the middle of the ready queues, 0 if it was not there.
+ */
+static int readyRemove(Thread thread){
+    if(thread->dlPeriod != 0) return edfRemove(thread);
+    if(!policy->remove(thread)) return 0;
+    readyCount--;
+    readyCoroutines -= thread->stackless;
+    return 1;
+}
+
+/*
+ * Sets the priority a thread starts at and returns to on each boost,
+ * 0 is the highest, PRIORITIES - 1 the lowest.
+ */
+void thread_set_priority(ThreadHandle handle, int priority){
+    Thread thread = threadLookup(handle);
+    int queued;
+
+    if(thread == NULL) return; // it has finished
+    if(priority < 0) priority = 0;
+    if(priority >= PRIORITIES) priority = PRIORITIES - 1;
+    preempt_disable();
+    queued = thread->state == READY && workerCount == 0 && readyRemove(thread);
+    thread->basePriority = thread->priority = priority;
+    thread->ticks = 0;
+    if(queued) readyEnqueue(thread); // into the queue for its new priority
+    preempt_enable();
+}
+
+/*
+ * Preemption is held off from here until this thread runs again.
+ */
+void threadYield(){
+    preempt_disable();
+    if(workerCount > 0){
+        workerSwitchOut(thisWorker());
+    }else{
+        if(policy->yield != NULL) policy->yield(currentThread);
+        scheduler(currentThread);
+    }
+    preempt_enable();
+}
+
+/*
+ * NULL from a pthread that is not running a thread.
+ */
+Thread thread_self(){
+    Worker *worker;
+    if(workerCount == 0) return currentThread;
+    return (worker = thisWorker()) != NULL ? worker->current : NULL;
+}
+
+/*
+ * Blocks the running thread until threadWake. Preemption must be disabled
+ * and lock, the guard of the wait queue the thread has been put on, held.
+ * The lock is released once the thread is switched out (with one pthread
+ * nothing can run in between anyway), so no waker can resume the thread
+ * while it is still on its stack.
+ */
+void threadPark(atomic_int *lock){
+    TRACE(TRACE_BLOCK, thread_self()->tid, 0);
+    if(workerCount > 0){
+        Worker *worker = thisWorker();
+        worker->current->state = BLOCKED;
+        worker->parkLock = lock;
+        workerSwitchOut(worker); // the loop releases lock
+    }else{
+        currentThread->state = BLOCKED;
+        if(policy->block != NULL) policy->block(currentThread);
+        spinUnlock(lock);
+        scheduler(currentThread);
+    }
+}
+
+/*
+ * Makes a BLOCKED thread READY. Preemption must be disabled.
+ * In M:N mode it goes on the waker's deque, so it usually runs next there.
+ */
+void threadWake(Thread thread){
+    TRACE(TRACE_WAKE, thread->tid, 0);
+    thread->state = READY;
+    if(workerCount > 0){
+        dequePush(&thisWorker()->ready, thread);
+        notifyWorkers();
+    }else{
+        readyEnqueue(thread);
+        updateTimer();
+    }
+}
+
+/*
+ * Whether thread, woken by self, would be picked before every READY
+ * thread and self, in single mode: neither is a deadline thread, and
+ * nothing else is READY or, under mlfq, nothing at its level or above,
+ * self included.
+ */
+static int wakesNext(Thread self, Thread thread){
+    int p = thread->priority;
+
+    if(self->dlPeriod != 0 || thread->dlPeriod != 0) return 0;
+    if(readyCount == 0) return 1;
+    return policy == &mlfqPolicy && edfHead == NULL
+            && self->priority >= p && !(readyLevels & ((2u << p) - 1));
+}
+
+/*
+ * Makes a BLOCKED thread READY and switches straight to it, the caller
+ * staying READY, so a thread handed data runs without waiting for a
+ * tick. Preemption must be disabled, once: from a timer callback, from
+ * main or inside the caller's own preempt_disable it only wakes the
+ * thread, as it does in single mode unless the thread is the one the
+ * deadline class and the policy would run next anyway (wakesNext).
+ */
+void threadWakeSwitch(Thread thread){
+    Thread self = thread_self();
+
+    if(self == NULL || self == mainThread || preemptDepth != 1
+            || (workerCount == 0 && !wakesNext(self, thread))){
+        threadWake(thread);
+        return;
+    }
+    TRACE(TRACE_WAKE, thread->tid, 0);
+    thread->state = READY;
+    if(workerCount > 0){
+        Worker *worker = thisWorker();
+        worker->runNext = thread; // run once the loop has requeued us
+        workerSwitchOut(worker);
+    }else{
+        readyEnqueue(self);
+        currentThread = thread;
+        updateTimer();
+        switcher(self, thread);
+    }
+}
+
+/*
+ * A preemption tick. The policy (policy.c) says whether the running thread
+ * is to be switched out. Deadline threads come before all others (edf.c):
+ * a running one is charged on every tick, and one woken with an earlier
+ * deadline than the running thread's takes over at once, through
+ * preemptPending. Only every ticksPerQuantum-th tick is a quantum tick,
+ * the others coming sooner so that waiting threads get in sooner
+ * (adaptTick).
+ */
+void timerHandler(int signum){
+    Thread thread = currentThread;
+    int quantumTick;
+
+    if(preemptDepth > 0){ // taken at the matching preempt_enable
+        preemptPending = 1;
+        return;
+    }
+    preemptDepth = 1;
+    preemptPending = 0;
+    if(workerCount > 0){ // only preempt pthreads running a thread
+        Worker *worker = thisWorker();
+        if(worker != NULL && worker->current != NULL) workerSwitchOut(worker);
+    }else{
+        runTimers();
+        ioPoll(0, NULL);
+        injectDrain();
+        if((quantumTick = ++subTicks >= ticksPerQuantum)) subTicks = 0;
+        setTickInterval();
+        if(thread == mainThread || reschedulePending){
+            scheduler(thread);
+        }else if(thread->dlPeriod != 0){
+            if(edfTick(thread)) scheduler(thread); // throttled
+            else settleTimer();
+        }else if(edfHead != NULL || policy->tick(thread, quantumTick)){
+            scheduler(thread);
+        }else{
+            settleTimer();
+        }
+    }
+    preemptDepth = 0;
+}
+
+/*
+ * The tick deferred by preempt_disable, called from preempt_enable.
+ */
+void preemptDeferred(){
+    timerHandler(SIGVTALRM);
+}
+
+/*
+ * Makes the calling pthread's preemption timer and starts it. It runs on
+ * CLOCK_MONOTONIC, which the kernel keeps to the microsecond, where
+ * CPU-time timers are only checked on its own tick (build with
+ * -DTICK_CPU_TIME for CLOCK_THREAD_CPUTIME_ID anyway), and it signals
+ * only this pthread, so each worker is preempted by its own timer.
+ */
+static void startTicking(){
+    struct sigevent event;
+#ifdef TICK_CPU_TIME
+    clockid_t clock = CLOCK_THREAD_CPUTIME_ID;
+#else
+    clockid_t clock = CLOCK_MONOTONIC;
+#endif
+
+    memset(&event,0,sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGVTALRM;
+    event.sigev_notify_thread_id = syscall(SYS_gettid);
+    if(timer_create(clock,&event,&tickTimer) != 0){
+        perror("creating preemption timer");
+        exit(EXIT_FAILURE);
+    }
+    setTickInterval();
+    setTimer(1);
+}
+
+/*
+ * Arms (on) the calling pthread's timer to tick every tickLength, the
+ * first tick one whole tick from now, or disarms it.
+ */
+static void setTimer(int on){
+    struct itimerspec interval;
+    memset(&interval,0,sizeof(interval));
+    if(on){
+        interval.it_value.tv_sec = tickLength / 1000000000;
+        interval.it_value.tv_nsec = tickLength % 1000000000;
+        interval.it_interval = interval.it_value;
+    }
+    if(timer_settime(tickTimer,0,&interval,NULL) != 0) exit(EXIT_FAILURE);
+    timerArmed = on;
+}
+
+/*
+ * Tickless: the timer only runs while two or more threads are runnable,
+ * the one in currentThread (unless it is the idle main thread) and the ready ones,
+ * or while one is and a runtime timer is pending or a thread waits for I/O,
+ * as the ticks fire the one and poll for the other.
+ */
+static int timerNeeded(){
+    int runnable = readyCount + (currentThread != mainThread);
+    return runnable >= 2 || (runnable == 1
+            && (atomic_load_explicit(&pendingTimers, memory_order_relaxed) > 0
+                || atomic_load_explicit(&ioWaiters, memory_order_relaxed) > 0));
+}
+
+/*
+ * The time slice for the threads runnable now: ADAPT_FACTOR quanta while
+ * every one of them has sunk to the bottom two levels of the feedback
+ * queue, as only CPU-bound threads do and switching between those sooner
+ * only costs time, else a quantum. A thread that wakes above them still
+ * gets in on the next tick. The other policies cannot tell CPU-bound
+ * threads apart, so get a quantum.
+ */
+static long long adaptSlice(){
+    unsigned int upper = (1u << (PRIORITIES - 2)) - 1; // the levels above the bottom two
+
+    if(adaptiveQuantum && policy == &mlfqPolicy && edfHead == NULL && !(readyLevels & upper)
+            && (currentThread == mainThread
+                || (currentThread->priority >= PRIORITIES - 2 && currentThread->dlPeriod == 0))){
+        return quantum * ADAPT_FACTOR;
+    }
+    return quantum;
+}
+
+/*
+ * The tick for a slice. A quantum / ADAPT_FACTOR while threads are waiting
+ * to get in: READY ones above the running thread's priority, which take
+ * over on the next tick, and ones sleeping on a runtime timer or waiting
+ * for I/O, which ticks fire and poll for. At most EDF_TICK while deadline
+ * threads exist. Otherwise the slice itself.
+ */
+static long long adaptTick(long long slice){
+    long long tick = slice;
+
+    if(adaptiveQuantum && (edfHead != NULL || (readyLevels & ((1u << currentThread->priority) - 1))
+            || atomic_load_explicit(&pendingTimers, memory_order_relaxed) > 0
+            || atomic_load_explicit(&ioWaiters, memory_order_relaxed) > 0)){
+        tick = quantum / ADAPT_FACTOR > MIN_QUANTUM ? quantum / ADAPT_FACTOR : MIN_QUANTUM;
+    }
+    if(edfThreads > 0 && tick > EDF_TICK) tick = EDF_TICK;
+    return tick < slice ? tick : slice;
+}
+
+/*
+ * Arms the timer as soon as it is needed, and brings its tick in as soon
+ * as threads are waiting. It is only disarmed, or its tick let out, by a
+ * tick, or the idle loop, finding it can be (settleTimer, setTickInterval),
+ * so threads handing work back and forth do not make system calls each time.
+ */
+static void updateTimer(){
+    if(!timerArmed){
+        if(timerNeeded()){
+            setTickInterval();
+            setTimer(1);
+        }
+    }else if(adaptTick(sliceLength) < tickLength){
+        setTickInterval();
+    }
+}
+
+static void settleTimer(){
+    if(timerArmed && !timerNeeded()) setTimer(0);
+}
+
+/*
+ * Adapts the slice and the tick to the threads runnable now, a changed
+ * tick taking effect at once if the timer is running. Workers tick every
+ * quantum.
+ */
+static void setTickInterval(){
+    long long tick = quantum;
+
+    if(workerCount == 0){
+        sliceLength = adaptSlice();
+        tick = adaptTick(sliceLength);
+        ticksPerQuantum = sliceLength / tick;
+    }
+    if(tick == tickLength) return;
+    tickLength = tick;
+    if(timerArmed) setTimer(1);
+}
+
+/*
+ * Installs the timer handler and starts the calling pthread's preemption
+ * timer, the slice a quantum (20ms unless thread_set_quantum says
+ * otherwise) adapted to the runnable threads.
+ */
+void startTimer(){
+    memset(&timerAction,0,sizeof(timerAction));
+    timerAction.sa_handler = (void*) timerHandler;
+    timerAction.sa_flags = SA_NODEFER | SA_RESTART; // nesting is handled by preemptDepth
+    sigaction(SIGVTALRM,&timerAction,NULL);
+    lastBoost = thread_now();
+    startTicking();
+}
+
+/*
+ * Deletes the calling pthread's preemption timer.
+ */
+void stopTimer(){
+    timer_delete(tickTimer);
+    timerArmed = 0;
+}
+
+/*
+ * Sets the base time slice, at least MIN_QUANTUM. Takes effect the next
+ * time the runtime starts its timer.
+ */
+void thread_set_quantum(long long ns){
+    quantum = ns < MIN_QUANTUM ? MIN_QUANTUM : ns;
+    sliceLength = quantum;
+}
+
+/*
+ * Turns the adaptive slice and tick off, ticking every quantum, or back on.
+ */
+void thread_set_adaptive_quantum(int on){
+    adaptiveQuantum = on;
+}
+
+/*
+ * Runs the threads until every one has finished.
+ * The main thread is the idle loop: it hands over to the ready threads
+ * and gets control back when none is left READY. If threads are still
+ * alive then, it sleeps in sigsuspend, with the timer off, until a
+ * signal handler makes one READY or another pthread injects a request,
+ * or in pselect until the next runtime timer, or in epoll while threads
+ * wait for I/O.
+ * Main itself is never preempted, it calls the scheduler itself.
+ */
+void setUpTimer(){
+    sigset_t oldSignals;
+    struct timespec timeout;
+
+    startTimer();
+    preempt_disable();
+    settleTimer();
+    injectListen(1);
+    while(atomic_load(&liveThreads) > 0){
+        runTimers();
+        ioPoll(0, NULL);
+        injectDrain();
+        if(readyCount > 0){
+            scheduler(mainThread); // back when nothing is READY
+            continue;
+        }
+        pthread_sigmask(SIG_BLOCK, &preemptSignals, &oldSignals);
+        if(readyCount == 0 && !injectPending()){ // idle
+            int timed = nextTimerTimeout(&timeout);
+            settleTimer();
+            if(atomic_load(&ioWaiters) > 0){
+                ioPoll(timed ? timeout.tv_sec * 1000 + (timeout.tv_nsec + 999999) / 1000000 : -1, &oldSignals);
+            }else if(timed){
+                pselect(0, NULL, NULL, NULL, &timeout, &oldSignals);
+            }else{
+                sigsuspend(&oldSignals);
+            }
+        }
+        pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+    }
+    injectListen(0);
+    stopTimer();
+    preempt_enable();
+}
+
+/**
+ * Transfer execution from original thread. Takes the next thread from the ready queue,
+ * putting origThread at the back of it if it can still run.
+ * Coroutines taken from the queue are run right here, on whatever stack
+ * this is, as they need none of their own, each at most once a call: one
+ * coming round again goes back in the queue, and origThread carries on,
+ * or the idle loop, so ticks and the idle loop still fire timers, poll
+ * for I/O and drain injections however long coroutines keep yielding.
+ * The main thread is never queued, it gets control back when nothing is READY.
+ * Called with preemption disabled.
+ * @param origThread the running thread
+ */
+void scheduler(Thread origThread){
+    Thread nextThread;
+    int queued = 0; // origThread went back in the queue for the coroutines
+    int steps = readyCoroutines; // the coroutines READY now, each run once
+
+    reschedulePending = 0;
+    while((nextThread = readyDequeue()) != NULL && nextThread->stackless){ // run here, they need no stack
+        if(steps-- == 0){ // come round again
+            readyEnqueue(nextThread);
+            nextThread = NULL;
+            if(queued) readyRemove(origThread);
+            break;
+        }
+        if(!queued && origThread->state == RUNNING && origThread != mainThread){
+            readyEnqueue(origThread);
+            queued = 1;
+        }
+        runCoroutine(nextThread);
+    }
+    if(nextThread == NULL){ // nothing else is READY
+        if(origThread->state == RUNNING){ // carry on with origThread
+            updateTimer();
+            return;
+        }
+        nextThread = mainThread; // the idle loop
+    }else if(!queued && origThread->state == RUNNING && origThread != mainThread){
+        readyEnqueue(origThread);
+    }
+    if(nextThread == origThread){ // its turn came round, or a coroutine woke it, while they ran
+        origThread->state = RUNNING;
+        if(origThread->dlPeriod != 0) edfSwitch(origThread, origThread); // charged when queued
+        updateTimer();
+        return;
+    }
+    currentThread = nextThread;
+    updateTimer();
+    switcher(origThread,nextThread);
+}
+
+/*
+ * Charges a coroutine for a step that ran for ran ns, in single mode: a
+ * quantum tick to the policy for each slice its steps have added up to,
+ * so under mlfq one that keeps yielding sinks like a CPU-bound thread.
+ */
+static void chargeCoroutine(Thread thread, long long ran){
+    thread->stepTime += ran;
+    while(thread->stepTime >= sliceLength){
+        thread->stepTime -= sliceLength;
+        policy->tick(thread, 1);
+    }
+}
+
+/*
+ * Switches execution from prevThread to nextThread.
+ */
+void switcher(Thread prevThread, Thread nextThread) {
+    if(prevThread->dlStart != 0 || nextThread->dlPeriod != 0) edfSwitch(prevThread, nextThread);
+    if (prevThread->state == FINISHED) { // it has finished
+        if(stackWatch) recordStackHighWater(prevThread);
+        deadThread = prevThread; // its stack released by nextThread
+        atomic_fetch_sub(&liveThreads, 1);
+        // Remove the prevThread from the circular linked list
+        if(headOfList == prevThread) headOfList = prevThread->next != prevThread ? prevThread->next : NULL;
+        prevThread->prev->next = prevThread->next;
+        prevThread->next->prev = prevThread->prev;
+        nextThread->state = RUNNING;
+        TRACE(TRACE_SWITCH, prevThread->tid, nextThread->tid);
+        restoreContext(nextThread->context);
+    } else { // we come back here when switched to
+        if(prevThread->state == RUNNING) prevThread->state = READY; // not when BLOCKED
+        nextThread->state = RUNNING;
+        TRACE(TRACE_SWITCH, prevThread->tid, nextThread->tid);
+        prevThread->preemptDepth = preemptDepth; // the depth goes with the thread
+        switchContext(prevThread->context, nextThread->context);
+        preemptDepth = prevThread->preemptDepth;
+        reapDeadStack();
+    }
+}
+
+/*
+ * Prints thread states
+ */
+void printThreadStates(){
+    int size = threadCount;
+    printf("Thread States\n");
+    printf("=============\n");
+    char* state;
+    for(int i=0;i<size;i++){ // free slots are left FINISHED
+        switch(threadAt(i)->state){
+            case SETUP:
+                state = "setup";
+                break;
+            case RUNNING:
+                state = "running";
+                break;
+            case READY:
+                state = "ready";
+                break;
+            case FINISHED:
+                state = "finished";
+                break;
+            case BLOCKED:
+                state = "blocked";
+                break;
+        }
+        printf("threadID: %d state:%s\n", threadAt(i)->tid, state);
+    }
+    printf("\n");
+}
+
+/*
+ * Makes finishing threads record their stack high-water mark, which
+ * costs a mincore call each, and stacks reused from the pool be scrubbed
+ * of their pages, an madvise each, so every thread spawned from here on
+ * has an exact mark.
+ */
+void thread_stack_watch(int on){
+    stackWatch = on;
+    stackPoolScrub(on);
+}
+
+/*
+ * A thread's stack high-water mark as its stack stands, 0 if the stack
+ * may hold an earlier thread's pages.
+ */
+static size_t liveStackHighWater(Thread thread){
+    return thread->stackClean ? stackHighWater(thread->stackAddr, thread->stackSize) : 0;
+}
+
+/*
+ * Records a finished thread's stack high-water mark, before its stack
+ * goes back in the pool.
+ */
+static void recordStackHighWater(Thread thread){
+    thread->stackHighWater = liveStackHighWater(thread);
+    thread->stackMark = thread->generation;
+    if(thread->stackHighWater > deepestStack) deepestStack = thread->stackHighWater;
+}
+
+/*
+ * Bytes of its stack the thread has used, to page granularity, from
+ * which pages of it are resident. Exact for a thread whose stack was
+ * fresh or that was spawned with thread_stack_watch on; 0 for one on a
+ * stack reused from the pool without it, as earlier threads' pages may
+ * still be resident there. For a finished thread, what was recorded when
+ * it finished if thread_stack_watch was on, else 0. The mark stays with
+ * its slot after its control block has been recycled, until the slot's
+ * next thread finishes.
+ */
+size_t thread_stack_high_water(ThreadHandle handle){
+    Thread thread = threadSlot(handle);
+    unsigned int generation = (unsigned int) (handle >> 32);
+    size_t highWater = 0;
+    if(thread == NULL) return 0;
+    preempt_disable();
+    pthread_mutex_lock(&runtimeLock); // a worker may be retiring it
+    if(thread->generation == generation && thread->stackAddr != NULL){
+        highWater = liveStackHighWater(thread);
+    }else if(thread->stackMark == generation){ // finished, and maybe recycled since
+        highWater = thread->stackHighWater;
+    }
+    pthread_mutex_unlock(&runtimeLock);
+    preempt_enable();
+    return highWater;
+}
+
+/*
+ * Prints each slot's thread's stack size and high-water mark, the last
+ * thread to use it if it is free, and the size that would hold the
+ * deepest stack of them and of every thread recorded finishing. A mark
+ * that is not known (thread_stack_high_water) is printed as such.
+ */
+void thread_stack_report(){
+    size_t deepest = deepestStack;
+    printf("Thread Stacks\n");
+    printf("=============\n");
+    preempt_disable();
+    pthread_mutex_lock(&runtimeLock);
+    for(int i=0;i<threadCount;i++){
+        Thread thread = threadAt(i);
+        size_t highWater;
+        if(thread->stackless) continue;
+        if(thread->stackAddr != NULL) highWater = liveStackHighWater(thread);
+        else highWater = thread->stackHighWater;
+        if(highWater > deepest) deepest = highWater;
+        if(highWater == 0) printf("threadID: %d stack: %zu high water: not known\n", thread->tid, thread->stackSize);
+        else printf("threadID: %d stack: %zu high water: %zu\n", thread->tid, thread->stackSize, highWater);
+    }
+    pthread_mutex_unlock(&runtimeLock);
+    preempt_enable();
+    printf("deepest %zu, a %zu byte stack would do\n", deepest, stackRoundSize(deepest ? deepest + 1 : 1));
+}
+
+/*
+ * Runs a new thread, on its own stack, the first time it is switched to.
+ * Does not return.
+ */
+static void threadRun(Thread thread) {
+    preemptDepth = 1; // the depth of whoever switched to us
+    reapDeadStack();
+    preempt_enable();
+    if(thread->returnsValue) thread->result = ((void *(*)(void *)) thread->start)(thread->arg);
+    else (thread->start)(thread->arg);
+    localsDestroy(thread);
+    preempt_disable();
+    threadFinish(thread);
+}
+
+#ifdef USE_SETJMP
+/*
+ * Associates the signal stack with the newThread.
+ * Also sets up the newThread to start running after it is long jumped to.
+ * This is called when SIGUSR1 is received.
+ */
+void associateStack(int signum) {
+    Thread localThread = newThread; // what if we don't use this local variable?
+    localThread->state = READY; // now it has its stack
+    if (saveContext(localThread->context) != 0) { // will be zero if called directly
+        threadRun(localThread);
+    }
+}
+#else
+/*
+ * Where a new thread's hand-made context (contextInit) starts. Whoever
+ * switched to it has made it the running thread.
+ */
+static void threadEntry() {
+    threadRun(thread_self());
+}
+#endif
+
+/*
+ * Finishes the running thread, waking its joiners. Preemption must be
+ * disabled once. Does not return.
+ */
+void threadFinish(Thread thread) {
+    edfLeave(thread);
+    wakeJoiners(thread);
+    TRACE(TRACE_FINISH, thread->tid, 0);
+    if(workerCount > 0) workerThreadFinished(thisWorker()); // does not return
+    thread->state = FINISHED;
+    scheduler(thread); // does not return
+}
+
+/*
+ * Marks the thread done and wakes the threads joining it, its result
+ * stored where each waits with (waitData, unless NULL), as the control
+ * block may be recycled before they run. Between them they take the one
+ * join a thread spawned by thread_spawn_value is kept for.
+ * Preemption must be disabled.
+ */
+static void wakeJoiners(Thread thread) {
+    Thread joiners;
+    int claim;
+
+    spinLock(&thread->joiners.guard);
+    atomic_store_explicit(&thread->done, 1, memory_order_release);
+    joiners = thread->joiners.head;
+    thread->joiners.head = thread->joiners.tail = NULL;
+    for(Thread joiner = joiners; joiner != NULL; joiner = joiner->waitNext){
+        if(joiner->waitData != NULL) *(void **) joiner->waitData = thread->result;
+    }
+    claim = joiners != NULL && thread->returnsValue && !thread->joinClaimed;
+    if(claim) thread->joinClaimed = 1;
+    spinUnlock(&thread->joiners.guard);
+    wakeAll(joiners);
+    if(claim) threadRelease(thread); // its retirement still holds it
+}
+
+/*
+ * Finishes the running thread as if its start function had returned
+ * result. Must not be called from main.
+ */
+void thread_exit(void *result){
+    Thread thread = thread_self();
+    thread->result = result;
+    localsDestroy(thread);
+    preemptDepth = 1; // whatever it had disabled is given up with it
+    threadFinish(thread);
+}
+
+/*
+ * Waits for thread to finish and, if result is not NULL, stores what its
+ * start function returned there (NULL unless spawned by thread_spawn_value
+ * or finished by thread_exit). Returns -1 if thread is the caller.
+ * A thread spawned by thread_spawn_value is kept until it has been joined
+ * once; any other is recycled as soon as it finishes, after which joining
+ * it returns at once with a NULL result, like joining a stale handle.
+ */
+int thread_join(ThreadHandle handle, void **result){
+    Thread thread = threadLookup(handle);
+    void *value = NULL;
+    int claim = 0;
+
+    if(thread != NULL && thread == thread_self()) return -1;
+    if(thread != NULL){
+        preempt_disable();
+        spinLock(&thread->joiners.guard);
+        if(thread->generation != handle >> 32){ // recycled since the lookup
+            spinUnlock(&thread->joiners.guard);
+        }else if(atomic_load_explicit(&thread->done, memory_order_relaxed)){
+            value = thread->result;
+            claim = thread->returnsValue && !thread->joinClaimed;
+            if(claim) thread->joinClaimed = 1;
+            spinUnlock(&thread->joiners.guard);
+        }else{
+            thread_self()->waitData = &value; // wakeJoiners stores the result there
+            waitOn(&thread->joiners);
+        }
+        if(claim) threadRelease(thread);
+        preempt_enable();
+    }
+    if(result != NULL) *result = value;
+    return 0;
+}
+
+#ifdef USE_SETJMP
+/*
+ * Sets up the user signal handler so that when SIGUSR1 is received
+ * it will use a separate stack. This stack is then associated with
+ * the newThread when the signal handler associateStack is executed.
+ */
+void setUpStackTransfer() {
+    setUpAction.sa_handler = (void *) associateStack;
+    setUpAction.sa_flags = SA_ONSTACK;
+    sigaction(SIGUSR1, &setUpAction, NULL);
+}
+#endif
+
+/*
+ *  Sets up the new thread.
+ *  The startFunc is the function called with arg when the thread starts running.
+ *  It also allocates space for the thread's stack, of stackSize bytes
+ *  as rounded by stackRoundSize(), and builds the context it starts
+ *  from there: by hand (contextInit), or with setjmp by the SIGUSR1
+ *  handler running on it, which costs a signal and two sigaltstack calls.
+ *  runtimeLock must be held.
+ */
+Thread createThread(void (startFunc)(), void *arg, size_t stackSize) {
+    Thread thread = allocThread(startFunc, arg);
+
+    thread->stackAddr = stackAlloc(stackSize, &thread->stackClean); // space for the stack, from the pool
+    thread->stackSize = stackSize;
+#ifdef USE_SETJMP
+    stack_t threadStack;
+    threadStack.ss_sp = thread->stackAddr;
+    threadStack.ss_size = stackSize; // the size of the stack
+    threadStack.ss_flags = 0;
+    if (sigaltstack(&threadStack, NULL) < 0) { // signal handled on threadStack
+        perror("sigaltstack");
+        exit(EXIT_FAILURE);
+    }
+    newThread = thread; // So that the signal handler can find this thread
+    raise(SIGUSR1); // Send the signal to this pthread. After this everything is set.
+    threadStack.ss_flags = SS_DISABLE; // so the thread may spawn others while running on it
+    sigaltstack(&threadStack, NULL);
+#else
+    contextInit(thread->context, thread->stackAddr, stackSize, threadEntry);
+    thread->state = READY;
+#endif
+    addThread(thread);
+    return thread;
+}
+
+/*
+ * A control block from the table with its fields set up, and no stack.
+ * runtimeLock must be held.
+ */
+static Thread allocThread(void (startFunc)(), void *arg) {
+    static int nextTID = 0;
+    Thread thread = tableTake();
+
+    thread->tid = nextTID++;
+    thread->state = SETUP;
+    thread->start = startFunc;
+    thread->arg = arg;
+    thread->priority = thread->basePriority = 0;
+    thread->ticks = 0;
+    thread->woken = 0;
+    thread->stackAddr = NULL;
+    thread->stackSize = 0;
+    thread->dlPeriod = thread->dlStart = 0;
+    thread->dlReleased = 0;
+    memset(&thread->dlTimer, 0, sizeof(Timer));
+    memset(&thread->dlStats, 0, sizeof(DeadlineStats));
+    atomic_store(&thread->parkState, 0); // a stale thread_unpark may still set it
+    atomic_init(&thread->parkGuard, 0);
+    thread->unparkNode.fn = NULL;
+    thread->unparkNode.arg = thread;
+    thread->returnsValue = 0;
+    thread->joinClaimed = 0;
+    thread->stackless = 0;
+    thread->resume = 0;
+    thread->stepTime = 0;
+    thread->waitData = NULL;
+    thread->result = NULL;
+    atomic_init(&thread->refs, 1);
+    atomic_init(&thread->done, 0);
+    thread->joiners.head = thread->joiners.tail = NULL; // its guard may be held by a stale joiner
+    localsInit(thread);
+    return thread;
+}
+
+/*
+ * Adds a new thread to the list.
+ */
+static void addThread(Thread thread) {
+    //add to the end of the circular linked list
+    if(headOfList == NULL) { // exactly 1 item in circular linked list
+        headOfList = thread;
+        headOfList->next = thread; headOfList->prev = thread;
+    }else{
+        thread->next = headOfList;thread->prev = headOfList->prev;
+        headOfList->prev->next = thread;
+        headOfList->prev = thread;
+    }
+}
+
+/*
+ * Creates a thread running fn(arg) and makes it READY.
+ * May be called from main or from inside a running thread; preemption
+ * is disabled while the thread list and table are changed.
+ * In M:N mode the thread goes on the calling worker's deque.
+ */
+ThreadHandle thread_spawn(void (*fn)(), void *arg){
+    return thread_spawn_stack(fn, arg, 0);
+}
+
+/*
+ * thread_spawn for a function returning a result, which thread_join gets.
+ */
+ThreadHandle thread_spawn_value(void *(*fn)(void *), void *arg){
+    return spawnThread((void (*)()) fn, arg, 0, 1);
+}
+
+/*
+ * thread_spawn with a stack of stackSize bytes, rounded up to a power of
+ * two pages and at least SIGSTKSZ, or the pool's default size if 0.
+ * Only the pages the thread touches are committed, so a large size costs
+ * address space until it is used.
+ */
+ThreadHandle thread_spawn_stack(void (*fn)(), void *arg, size_t stackSize){
+    return spawnThread(fn, arg, stackSize, 0);
+}
+
+/*
+ * Creates a thread and makes it READY. returnsValue is set before the
+ * thread can first run. The handle is taken then too, as a thread that
+ * may not be joined can finish and be recycled as soon as it is READY.
+ */
+static ThreadHandle spawnThread(void (*fn)(), void *arg, size_t stackSize, int returnsValue){
+    Thread thread;
+    ThreadHandle handle;
+
+    if(stackSize != 0 && stackSize < SIGSTKSZ) stackSize = SIGSTKSZ;
+    preempt_disable();
+    pthread_mutex_lock(&runtimeLock);
+    thread = createThread(fn, arg, stackRoundSize(stackSize));
+    thread->returnsValue = returnsValue;
+    if(returnsValue) atomic_init(&thread->refs, 2); // one for its join
+    handle = thread_handle(thread);
+    pthread_mutex_unlock(&runtimeLock);
+    startThread(thread);
+    preempt_enable();
+    return handle;
+}
+
+/*
+ * Creates count threads running fn(args[i]), or fn(NULL) if args is NULL,
+ * with the default stack, and makes them READY together. The stacks the
+ * pool lacks are mapped at once, the threads set up in one pass under
+ * one lock, and in M:N mode the workers are woken once for all of them.
+ * The threads are not joinable.
+ */
+void thread_spawn_batch(int count, void (*fn)(), void **args){
+    size_t stackSize = stackRoundSize(0);
+    Thread first = NULL, last = NULL;
+
+    if(count <= 0) return;
+    preempt_disable();
+    pthread_mutex_lock(&runtimeLock);
+    stackReserve(stackSize, count);
+    for(int i=0;i<count;i++){
+        Thread thread = createThread(fn, args != NULL ? args[i] : NULL, stackSize);
+        if(last == NULL) first = thread;
+        else last->readyNext = thread;
+        last = thread;
+    }
+    pthread_mutex_unlock(&runtimeLock);
+    startThreads(first, count);
+    preempt_enable();
+}
+
+/*
+ * Makes a new thread READY. Preemption must be disabled.
+ * In M:N mode the thread goes on the calling worker's deque.
+ */
+static void startThread(Thread thread){
+    startThreads(thread, 1);
+}
+
+/*
+ * Makes count new threads READY, linked by readyNext from first.
+ * Preemption must be disabled.
+ */
+static void startThreads(Thread first, int count){
+    Worker *worker = workerCount > 0 ? thisWorker() : NULL;
+
+    atomic_fetch_add(&liveThreads, count);
+    for(Thread thread = first, next; count-- > 0; thread = next){
+        next = thread->readyNext;
+        TRACE(TRACE_CREATE, thread->tid, thread_self() != NULL ? thread_self()->tid : TRACE_NOBODY);
+        if(workerCount == 0) readyEnqueue(thread);
+        else if(worker != NULL) dequePush(&worker->ready, thread);
+    }
+    if(workerCount == 0){
+        if(currentThread != mainThread) updateTimer(); // main calls it when it starts them
+    }else if(worker != NULL){
+        notifyWorkers();
+    }
+}
+
+/*
+ * Sets up the main thread, and the stack transfer handler if threads
+ * are started through it (USE_SETJMP), and picks the policy named in
+ * THREAD_POLICY, if any.
+ * Must be called before the first thread is spawned.
+ */
+void threadInit(){
+    mainThread = &controller;
+    mainThread->tid = -1;
+    mainThread->state = RUNNING;
+    localsInit(mainThread);
+    currentThread = mainThread;
+    sigemptyset(&preemptSignals);
+    sigaddset(&preemptSignals, SIGVTALRM);
+    if(getenv("THREAD_POLICY") != NULL && thread_set_policy(getenv("THREAD_POLICY")) < 0){
+        fprintf(stderr, "unknown THREAD_POLICY %s, using %s\n", getenv("THREAD_POLICY"), policy->name);
+    }
+#ifdef USE_SETJMP
+    setUpStackTransfer();
+#endif
+}
@@ -7,17 +7,412 @@
  ============================================================================
  */
 
+#ifndef LITTLETHREAD_H
+#define LITTLETHREAD_H
+
 #include <setjmp.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+/*
+ * Saved registers for a context switch.
+ * Defaults to a hand written switch on x86-64 and AArch64 (context.c),
+ * otherwise or with -DUSE_SETJMP falls back to setjmp/longjmp.
+ * Context is an array type like jmp_buf, so it is passed by reference.
+ */
+#if !defined(USE_SETJMP) && !defined(__x86_64__) && !defined(__aarch64__)
+#define USE_SETJMP
+#endif
+
+#ifdef USE_SETJMP
+typedef jmp_buf Context;
+#define saveContext(ctx) setjmp(ctx)
+#define restoreContext(ctx) longjmp(ctx, 1)
+#define switchContext(from, to) do { if (setjmp(from) == 0) longjmp(to, 1); } while (0)
+#else
+typedef struct context {
+#if defined(__x86_64__)
+	void *rsp, *rip;		// stack pointer and resume address
+	void *rbx, *rbp, *r12, *r13, *r14, *r15;
+#else
+	void *x[12];			// x19-x30
+	void *sp;				// stack pointer
+	double d[8];			// d8-d15
+#endif
+} Context[1];
+int saveContext(Context ctx) __attribute__((returns_twice)); // 0 when saving, 1 when restored
+void restoreContext(Context ctx) __attribute__((noreturn));
+void switchContext(Context from, Context to); // save into from, resume to
+#endif
+
+/*
+ * A runtime timer (timers.c). The caller owns the memory, which must stay
+ * valid while the timer is pending, so arming one never allocates.
+ */
+typedef struct timer {
+	struct timer *next;		// in its wheel slot
+	struct timer **pprev;	// the pointer to this timer in its slot
+	struct timer *firedNext;	// in the list of timers due
+	long long expires;		// CLOCK_MONOTONIC ns
+	long long period;		// 0 for a one-shot timer
+	void (*callback)(void *arg);	// run by the scheduler, must not block
+	void *arg;
+	short level, slot;		// where it is in the wheel
+	int pending;
+} Timer;
+
+/* Threads waiting for something (sync.c) */
+typedef struct waitQueue {
+	atomic_int guard;		// spinlock, held with preemption disabled
+	struct thread *head;	// BLOCKED threads in the order they are woken, linked by waitNext
+	struct thread *tail;
+} WaitQueue;
+
+#define THREAD_LOCALS 16	// thread-local storage keys (locals.c)
+
+/* How a deadline thread has done (edf.c) */
+typedef struct deadlineStats {
+	long long periods;		// periods begun
+	long long misses;		// periods in which it ran past the deadline
+	long long overruns;		// times it used up its budget and was throttled
+	long long maxLateness;	// ns past a deadline it was found running, at most
+} DeadlineStats;
+
+/* A request handed to the runtime from outside it (inject.c) */
+typedef struct injection {
+	struct injection *next;	// in the injection queue
+	void (*fn)();			// start function of a thread to spawn, NULL to wake the thread in arg
+	void *arg;
+} Injection;
 
 /* The thread states */
-enum state_t { SETUP, RUNNING, READY, FINISHED };
+enum state_t { SETUP, RUNNING, READY, FINISHED, BLOCKED };
 
+/*
+ * A thread's control block, allocated from slabs and recycled once it has
+ * finished (threadTable.c). The fields the scheduler touches on every
+ * switch come first, in the first two cache lines.
+ */
 typedef struct thread {
-	int tid;				// thread identifier
-	void (*start)();		// the start function
-	jmp_buf environment;	// saved registers
 	enum state_t state;		// the state
+	int tid;				// thread identifier
+	int priority;			// current feedback queue level, 0 is highest
+	int basePriority;		// level it starts at and is boosted back to
+	int ticks;				// timer ticks used at the current level
+	int woken;				// mlfq: blocked since it last ran, queued ahead of its level's others
+	int preemptDepth;		// preemptDepth while switched out
+	int stackless;			// a coroutine, start is its step function
+	atomic_uint generation;	// of its slot, in its handle, bumped when it is recycled
+	struct thread *readyNext;	// next in the ready queue, or the free list
+	struct thread *waitNext;	// next in a wait queue while BLOCKED
+	void (*start)();		// the start function, called with arg
+	void *arg;				// the argument to start, or a coroutine's frame
+	Context context;		// saved registers
+	int slot;				// its index in the thread table
+	int resume;				// where its step carries on, see CO_BEGIN
+	long long stepTime;		// ns its steps have run not yet charged as ticks
+	int returnsValue;		// start is a void *(*)(void *) whose result is kept
+	int joinClaimed;		// a join has taken its result, under joiners' guard
+	atomic_int refs;		// the finished thread's retirement, and a join if returnsValue
+	atomic_int done;		// set, with joiners' guard held, once it has finished
+	void *waitData;			// what it waits with, e.g. a channel element
+	void *result;			// for thread_join
+	WaitQueue joiners;		// threads in thread_join
 	void *stackAddr;		// the stack address
+	size_t stackSize;		// usable bytes of the stack
+	int stackClean;			// its stack came with no other thread's pages, see stackAlloc
+	size_t stackHighWater;	// bytes of it used, recorded when it finished
+	unsigned int stackMark;	// the generation stackHighWater was recorded for, kept when recycled
 	struct thread *prev;	// pointer to the previous thread
 	struct thread *next;	// pointer to the next thread
-} *Thread;
+	Timer sleepTimer;		// wakes it from thread_sleep
+	long long dlPeriod;		// deadline class: ns per period, 0 for best effort
+	long long dlBudget;		// ns of CPU it may use in each period
+	long long dlDeadline;	// the end of its current period, CLOCK_MONOTONIC ns
+	long long dlRuntime;	// budget left in the current period
+	long long dlStart;		// when it last started running, 0 while it is not
+	int dlMissed;			// the current period's miss has been counted
+	int dlReleased;			// woke at the start of a period it was given
+	Timer dlTimer;			// refills its budget while it is throttled
+	DeadlineStats dlStats;
+	atomic_int parkState;	// thread_park: 1 unparked since, 2 parked, else 0
+	atomic_int parkGuard;	// held from parking until it is switched out
+	Injection unparkNode;	// queued by thread_unpark to wake it
+	void *locals[THREAD_LOCALS];	// its values of the thread-local keys
+	unsigned long long random[4];	// its xoshiro256** state
+} __attribute__((aligned(64))) *Thread;
+
+/*
+ * Handles name threads for other threads: the slot's generation above its
+ * index, so a handle to a thread whose control block has been recycled is
+ * seen to be stale. 0 is never a thread.
+ */
+typedef unsigned long long ThreadHandle;
+
+/* The thread API (littleThread.c) */
+ThreadHandle thread_spawn(void (*fn)(), void *arg);	// create a READY thread running fn(arg)
+ThreadHandle thread_spawn_stack(void (*fn)(), void *arg, size_t stackSize);	// with a stack of stackSize bytes, 0 the default
+ThreadHandle thread_spawn_value(void *(*fn)(void *), void *arg);	// fn's result is kept for thread_join
+void thread_spawn_batch(int count, void (*fn)(), void **args);	// count threads running fn(args[i]), in one pass
+void thread_exit(void *result);					// finish the running thread
+int thread_join(ThreadHandle thread, void **result);	// BLOCKED until it finishes, threads only, -1 on itself
+void threadYield();								// give up the rest of the time slice
+void threadRunWorkers(int count);				// M:N, run all threads on count pthreads
+void thread_set_priority(ThreadHandle thread, int priority);	// 0 highest, ignored in M:N mode
+Thread thread_self();							// the running thread's own control block
+ThreadHandle thread_handle(Thread thread);		// a handle to a live thread, 0 for NULL
+void thread_set_quantum(long long ns);			// base time slice, 20ms by default
+void thread_set_adaptive_quantum(int on);		// adapt slice and tick to the runnable threads, on by default
+size_t thread_stack_high_water(ThreadHandle thread);	// bytes of its stack used, 0 if not known
+void thread_stack_watch(int on);				// record the high-water mark of finishing threads
+void thread_stack_report();						// print each thread's stack use
+
+/*
+ * Scheduling policies (policy.c), in single mode. The policy keeps the
+ * READY threads and picks the next to run; deadline threads still come
+ * first. The shipped ones are "mlfq" (the default), "fifo", "rr" and
+ * "random", picked by name or by the THREAD_POLICY environment variable,
+ * read by threadInit. A program may plug in its own; its hooks are called
+ * with preemption disabled, and it may link threads by readyNext.
+ */
+typedef struct schedPolicy {
+	const char *name;
+	void (*enqueue)(Thread thread);	// thread has become READY
+	Thread (*dequeue)();			// takes out the READY thread to run next, NULL if none
+	int (*remove)(Thread thread);	// takes out a READY thread, 0 if it is not there
+	int (*tick)(Thread thread, int quantumTick);	// 1 to switch the running thread out
+	void (*yield)(Thread thread);	// it is giving up the CPU, may be NULL
+	void (*block)(Thread thread);	// it is BLOCKED, may be NULL
+} SchedPolicy;
+
+int thread_set_policy(const char *name);		// -1 if there is no such policy
+void thread_set_policy_ops(const SchedPolicy *policy);	// the READY threads move over
+const char *thread_policy_name();
+
+/*
+ * Deadline scheduling (edf.c), in single mode. A deadline thread gets
+ * budget ns of CPU in every period ns, before any best-effort thread and
+ * by the end of the period; READY ones run earliest deadline first.
+ * A set of threads whose budgets would overcommit the CPU is rejected.
+ * A periodic thread ends each period's work with thread_deadline_yield.
+ *	if (thread_set_deadline(thread_handle(thread_self()), 5000000, 1000000) == 0) {
+ *		for (;;) { control(); thread_deadline_yield(); }
+ *	}
+ */
+int thread_set_deadline(ThreadHandle thread, long long period, long long budget);	// -1 if not admitted, period 0 for best effort
+void thread_deadline_yield();					// sleep until its next period
+int thread_deadline_stats(ThreadHandle thread, DeadlineStats *stats);	// -1 for a stale handle
+void thread_deadline_report();					// print each deadline thread's stats
+
+/*
+ * Injection (inject.c), from outside the runtime: any pthread may call
+ * these, and thread_unpark also a signal handler, without a lock. Requests
+ * go on a lock-free queue the runtime drains on its next tick, or at once
+ * if it is idle. A thread waits for an outside event with thread_park:
+ *	while (!atomic_load(&done)) thread_park();		// in the thread
+ *	atomic_store(&done, 1); thread_unpark(waiter);	// in a library's callback
+ */
+int thread_inject_spawn(void (*fn)(), void *arg);	// a thread running fn(arg) soon, -1 if out of memory
+void thread_park();								// BLOCKED until unparked, may return early
+void thread_unpark(ThreadHandle thread);		// wakes it, or its next park returns at once
+
+/*
+ * Offloading (offload.c). A blocking call runs on a helper pthread while
+ * only the calling thread waits, parked, so a slow disk or DNS lookup does
+ * not hold up the other threads. errno is as the call left it. Outside a
+ * thread the call is made directly.
+ * In M:N mode the thread may come back on another pthread, with its own
+ * errno, and the compiler may reuse errno's address from before the call:
+ * only read errno after a call that failed, never set it before one.
+ */
+void *thread_offload(void *(*fn)(void *), void *arg);	// fn(arg) on a helper, its result
+void thread_offload_helpers(int count);			// helper pthreads at most, 4 by default
+int thread_open(const char *path, int flags, mode_t mode);
+ssize_t thread_pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t thread_pwrite(int fd, const void *buf, size_t count, off_t offset);
+int thread_fsync(int fd);
+int thread_stat(const char *path, struct stat *st);
+
+/*
+ * Synchronization (sync.c). A thread that has to wait is BLOCKED, off the
+ * ready queues, until the releaser makes it READY again. Only threads may
+ * block, not main. All zero is a valid initial value of each of them.
+ */
+typedef struct mutex {
+	atomic_int state;		// 0 free, 1 locked, 2 locked and maybe waited for
+	WaitQueue waiters;
+} Mutex;
+
+typedef struct condition {
+	WaitQueue waiters;
+} Condition;
+
+typedef struct semaphore {
+	atomic_int count;
+	WaitQueue waiters;
+} Semaphore;
+
+typedef struct future {
+	atomic_int ready;		// set once value has been
+	void *value;
+	WaitQueue waiters;
+} Future;
+
+typedef struct barrier {
+	int parties;			// threads that must arrive
+	int arrived;
+	WaitQueue waiters;
+} Barrier;
+
+#define MUTEX_INITIALIZER { 0 }
+#define CONDITION_INITIALIZER { { 0 } }
+
+void thread_mutex_init(Mutex *mutex);
+void thread_mutex_lock(Mutex *mutex);
+int thread_mutex_trylock(Mutex *mutex);			// 1 if it was taken
+void thread_mutex_unlock(Mutex *mutex);			// wakes the first waiter
+void thread_cond_init(Condition *cond);
+void thread_cond_wait(Condition *cond, Mutex *mutex);
+void thread_cond_signal(Condition *cond);
+void thread_cond_broadcast(Condition *cond);
+void thread_sem_init(Semaphore *sem, int count);
+void thread_sem_wait(Semaphore *sem);
+int thread_sem_trywait(Semaphore *sem);			// 1 if the count was taken
+void thread_sem_post(Semaphore *sem);
+void thread_barrier_init(Barrier *barrier, int parties);
+int thread_barrier_wait(Barrier *barrier);		// 1 in the last thread to arrive
+void thread_future_init(Future *future);
+int thread_future_set(Future *future, void *value);	// -1 if it was already set
+void *thread_future_get(Future *future);		// BLOCKED until it is set
+int thread_future_ready(Future *future);		// 1 if get would not block
+
+/*
+ * Channels (channel.c), passing elements of elemSize bytes by copy.
+ * Buffered ones hold capacity elements, unbuffered ones (capacity 0) make
+ * the sender wait for a receiver, CHANNEL_UNBOUNDED ones grow and never
+ * make a sender wait. Only threads may call them.
+ */
+#define CHANNEL_UNBOUNDED -1
+
+typedef struct channel {
+	WaitQueue waiters;		// blocked senders or receivers, never both; guard locks the channel
+	int sendersWait;		// the waiters are senders
+	int closed;
+	size_t elemSize;
+	int capacity;			// 0 unbuffered, or CHANNEL_UNBOUNDED
+	int slots;				// allocated in buffer
+	int head;				// the oldest element
+	int count;				// elements in buffer
+	char *buffer;			// a ring of slots elements
+} Channel;
+
+int thread_chan_init(Channel *chan, size_t elemSize, int capacity);	// -1 if out of memory
+void thread_chan_destroy(Channel *chan);
+int thread_chan_send(Channel *chan, const void *elem);	// -1 if closed
+int thread_chan_recv(Channel *chan, void *elem);	// 0 once closed and drained
+int thread_chan_send_batch(Channel *chan, const void *elems, int count);	// sent, fewer only if closed
+int thread_chan_recv_batch(Channel *chan, void *elems, int max);	// waits for 1, 0 once closed and drained
+void thread_chan_close(Channel *chan);			// wakes every waiter
+
+/*
+ * Time (timers.c), in CLOCK_MONOTONIC nanoseconds. Timers are checked on
+ * each preemption tick and whenever the runtime is idle, with a resolution
+ * of about a millisecond. They never fire early.
+ */
+long long thread_now();
+void thread_sleep(long long ns);				// BLOCKED for at least ns, threads only
+void thread_sleep_until(long long deadline);
+void thread_timer_start(Timer *timer, long long delay, long long period,
+		void (*callback)(void *arg), void *arg);	// period 0 for one-shot
+int thread_timer_cancel(Timer *timer);			// 1 if it was pending
+
+/*
+ * I/O (io.c). Like the system calls, but a call that would block parks
+ * only the calling thread until the fd is ready. The fd must be
+ * non-blocking; thread_accept and thread_connect make their sockets so.
+ */
+int thread_set_nonblocking(int fd);
+ssize_t thread_read(int fd, void *buf, size_t count);
+ssize_t thread_write(int fd, const void *buf, size_t count);
+int thread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+int thread_connect(int fd, const struct sockaddr *addr, socklen_t addrlen);
+
+/*
+ * Stackless coroutines (coroutine.c). A coroutine is a thread without a
+ * stack: its step function is called by the scheduler, on the scheduler's
+ * stack, and runs until it yields, waits or ends, then returns. Locals do
+ * not survive that, state goes in the frame, allocated on the heap when
+ * it is spawned. The body goes between CO_BEGIN and CO_END, each CO_
+ * macro on a line of its own, and must not call blocking functions, only
+ * CO_ ones.
+ * Coroutines are scheduled with the threads, can be joined by them and
+ * join them.
+ *	int counter(Thread self, void *frame) {
+ *		struct count *c = frame;
+ *		CO_BEGIN(self);
+ *		for (c->i = 0; c->i < 10; c->i++) CO_YIELD(self);
+ *		CO_END(self);
+ *	}
+ */
+enum coStatus { CO_YIELDED, CO_BLOCKED, CO_DONE };
+
+ThreadHandle thread_spawn_coroutine(int (*step)(Thread self, void *frame),
+		size_t frameSize, const void *frame);	// frame copied in, if not NULL
+ThreadHandle thread_spawn_coroutine_value(int (*step)(Thread self, void *frame),
+		size_t frameSize, const void *frame);	// its result is kept for a join
+int thread_co_join(Thread self, ThreadHandle thread, void **result);	// for CO_JOIN
+int thread_co_await(Thread self, Future *future, void **value);	// for CO_AWAIT
+
+#define CO_BEGIN(self) switch ((self)->resume) { case 0:
+#define CO_END(self) } (self)->resume = -1; return CO_DONE
+#define CO_YIELD(self) do { (self)->resume = __LINE__; return CO_YIELDED; case __LINE__:; } while (0)
+#define CO_RETURN(self, value) do { (self)->result = (value); (self)->resume = -1; return CO_DONE; } while (0)
+#define CO_JOIN(self, thread, result) do { (self)->resume = __LINE__; case __LINE__: \
+		if (!thread_co_join((self), (thread), (result))) return CO_BLOCKED; } while (0)
+#define CO_AWAIT(self, future, value) do { (self)->resume = __LINE__; case __LINE__: \
+		if (!thread_co_await((self), (future), (value))) return CO_BLOCKED; } while (0)
+
+/*
+ * Thread-local storage and random numbers (locals.c), in the running
+ * thread's control block, so they need no locking or masking.
+ */
+typedef int ThreadKey;
+
+int thread_key_create(ThreadKey *key, void (*destructor)(void *));	// -1 if none is left
+void thread_key_delete(ThreadKey key);
+void *thread_getspecific(ThreadKey key);
+int thread_setspecific(ThreadKey key, void *value);	// -1 off a thread
+void thread_random_seed(unsigned long long seed);	// for threads created from now on, and the caller
+unsigned long long thread_random();				// 64 random bits, xoshiro256**
+void thread_random_fill(void *buffer, size_t count);	// count random bytes
+
+/*
+ * Event tracing (trace.c): switches, creation, finishing, blocking and
+ * waking, recorded into a ring and exported as Chrome trace JSON.
+ */
+void thread_trace_start(unsigned long events);	// ring size, the oldest are overwritten
+void thread_trace_stop();
+int thread_trace_export(const char *path);		// -1 if it cannot be written
+
+/*
+ * Preemption control. The running thread's nesting depth lives in user
+ * memory, a tick arriving while it is non-zero is only noted and taken
+ * by the outermost preempt_enable. No system calls.
+ */
+extern __thread volatile int preemptDepth;
+extern __thread volatile int preemptPending;
+void preemptDeferred();
+
+static inline void preempt_disable() {
+	preemptDepth++;
+	__asm__ volatile("" ::: "memory");
+}
+
+static inline void preempt_enable() {
+	__asm__ volatile("" ::: "memory");
+	if (--preemptDepth == 0 && preemptPending) preemptDeferred();
+}
+
+#endif
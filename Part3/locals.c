@@ -0,0 +1,176 @@
+/*
+ ============================================================================
+ Name        : locals.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Thread-local storage and a per-thread random number
+               generator. Both live in struct thread, so nothing is
+               switched or masked: a thread reaches its own through
+               thread_self(), and no other thread touches them.
+               Keys work like pthread keys, THREAD_LOCALS of them, with
+               destructors run on the thread's own stack as it finishes.
+               The generator is xoshiro256** (Blackman and Vigna), each
+               thread's seeded from its tid and the global seed with
+               splitmix64, so runs are repeatable.
+               A pthread not running a thread (a worker's loop, timer
+               callbacks there) gets a generator of its own but no locals.
+ ============================================================================
+ */
+
+static atomic_uint keysUsed = 0; // bit k set while key k exists
+static void (*keyDestructors[THREAD_LOCALS])(void *);
+static unsigned long long randomSeed = 0x9e3779b97f4a7c15ULL;
+static __thread unsigned long long pthreadRandom[4]; // off a thread, seeded on first use
+static __thread int pthreadRandomSeeded = 0;
+
+static unsigned long long splitmix64(unsigned long long *x) {
+    unsigned long long z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void randomSeedState(unsigned long long state[4], unsigned long long seed) {
+    for (int i = 0; i < 4; i++) state[i] = splitmix64(&seed);
+}
+
+/*
+ * Sets up a new thread's locals and generator.
+ */
+static void localsInit(Thread thread) {
+    memset(thread->locals, 0, sizeof(thread->locals));
+    randomSeedState(thread->random, randomSeed ^ (unsigned long long) thread->tid * 0xd1b54a32d192ed03ULL);
+}
+
+/*
+ * Runs the destructors of the finishing thread's non-NULL locals.
+ */
+static void localsDestroy(Thread thread) {
+    unsigned int used = atomic_load_explicit(&keysUsed, memory_order_acquire);
+
+    while (used != 0) {
+        int key = __builtin_ctz(used);
+        void *value = thread->locals[key];
+        used &= used - 1;
+        if (value != NULL && keyDestructors[key] != NULL) {
+            thread->locals[key] = NULL;
+            keyDestructors[key](value);
+        }
+    }
+}
+
+/*
+ * Creates a key, NULL in every thread, whose destructor (if not NULL) is
+ * called with a finishing thread's value unless that is NULL.
+ * Returns -1 if all THREAD_LOCALS keys are in use.
+ */
+int thread_key_create(ThreadKey *key, void (*destructor)(void *)) {
+    unsigned int used = atomic_load(&keysUsed);
+    int k;
+
+    do {
+        if (used == (1ull << THREAD_LOCALS) - 1) return -1;
+        k = __builtin_ctz(~used);
+    } while (!atomic_compare_exchange_weak(&keysUsed, &used, used | 1u << k));
+    keyDestructors[k] = destructor;
+    preempt_disable();
+    pthread_mutex_lock(&runtimeLock);
+    for (int i = 0; i < threadCount; i++) threadAt(i)->locals[k] = NULL; // left by a deleted key
+    controller.locals[k] = NULL;
+    pthread_mutex_unlock(&runtimeLock);
+    preempt_enable();
+    *key = k;
+    return 0;
+}
+
+/*
+ * Frees a key for reuse. No destructors are run.
+ */
+void thread_key_delete(ThreadKey key) {
+    atomic_fetch_and(&keysUsed, ~(1u << key));
+}
+
+/*
+ * NULL off a thread, or if the running thread has not set it.
+ */
+void *thread_getspecific(ThreadKey key) {
+    Thread self = thread_self();
+    return self != NULL ? self->locals[key] : NULL;
+}
+
+/*
+ * Returns -1 off a thread.
+ */
+int thread_setspecific(ThreadKey key, void *value) {
+    Thread self = thread_self();
+    if (self == NULL) return -1;
+    self->locals[key] = value;
+    return 0;
+}
+
+/*
+ * The running thread's generator, or the pthread's own.
+ */
+static unsigned long long *randomState() {
+    Thread self = thread_self();
+    if (self != NULL) return self->random;
+    if (!pthreadRandomSeeded) {
+        randomSeedState(pthreadRandom, randomSeed ^ (unsigned long long) pthread_self());
+        pthreadRandomSeeded = 1;
+    }
+    return pthreadRandom;
+}
+
+static inline unsigned long long rotl(unsigned long long x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline unsigned long long xoshiroNext(unsigned long long s[4]) {
+    unsigned long long result = rotl(s[1] * 5, 7) * 9;
+    unsigned long long t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+/*
+ * Sets the seed that threads created from now on derive theirs from, and
+ * reseeds the calling thread's generator with it.
+ */
+void thread_random_seed(unsigned long long seed) {
+    randomSeed = seed;
+    randomSeedState(randomState(), seed);
+}
+
+/*
+ * 64 random bits.
+ */
+unsigned long long thread_random() {
+    return xoshiroNext(randomState());
+}
+
+/*
+ * Fills count bytes at buffer, with the state kept in registers
+ * throughout rather than loaded and stored for every 8 bytes.
+ */
+void thread_random_fill(void *buffer, size_t count) {
+    unsigned long long *state = randomState();
+    unsigned long long s[4] = { state[0], state[1], state[2], state[3] };
+    char *next = buffer;
+
+    for (; count >= sizeof(unsigned long long); count -= sizeof(unsigned long long)) {
+        unsigned long long value = xoshiroNext(s);
+        memcpy(next, &value, sizeof(value));
+        next += sizeof(value);
+    }
+    if (count > 0) {
+        unsigned long long value = xoshiroNext(s);
+        memcpy(next, &value, count);
+    }
+    memcpy(state, s, sizeof(s));
+}
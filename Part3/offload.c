@@ -0,0 +1,182 @@
+/*
+ ============================================================================
+ Name        : offload.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Offloading blocking calls. Calls epoll cannot wait for,
+               like disk I/O and getaddrinfo, would block the pthread
+               running every other thread, so thread_offload() runs them on
+               a helper pthread while the calling thread parks until the
+               helper unparks it (inject.c). Helpers are started as jobs
+               find none idle, up to thread_offload_helpers(), and then
+               wait for more; with all of them busy jobs queue, so one slow
+               disk ties up at most the helpers, never the runtime.
+               The job lives on the caller's stack. Helpers block every
+               signal, so ticks and the program's signals still go to the
+               pthreads running threads.
+ ============================================================================
+ */
+
+#include <sys/stat.h>
+
+#define OFFLOAD_HELPERS 4 // helper pthreads at most, by default
+
+typedef struct offloadJob {
+    struct offloadJob *next; // in the queue
+    void *(*fn)(void *);
+    void *arg;
+    void *result;
+    int error; // errno as fn left it
+    ThreadHandle caller; // unparked once done is set
+    atomic_int done;
+} OffloadJob;
+
+/* The arguments of the wrappers' calls */
+typedef struct offloadCall {
+    const char *path;
+    int fd;
+    int flags;
+    mode_t mode;
+    void *buf;
+    size_t count;
+    off_t offset;
+    struct stat *st;
+} OffloadCall;
+
+static pthread_mutex_t offloadLock = PTHREAD_MUTEX_INITIALIZER; // the queue and the counts
+static pthread_cond_t offloadWork = PTHREAD_COND_INITIALIZER; // signalled when a job is queued
+static OffloadJob *offloadHead = NULL, *offloadTail = NULL; // jobs waiting for a helper
+static int offloadHelpers = 0; // started
+static int offloadIdle = 0; // waiting for a job
+static int offloadMax = OFFLOAD_HELPERS;
+
+static void *offloadHelper(void *arg) {
+    pthread_mutex_lock(&offloadLock);
+    for (;;) {
+        OffloadJob *job;
+        ThreadHandle caller;
+
+        while (offloadHead == NULL) {
+            offloadIdle++;
+            pthread_cond_wait(&offloadWork, &offloadLock);
+            offloadIdle--;
+        }
+        job = offloadHead;
+        if ((offloadHead = job->next) == NULL) offloadTail = NULL;
+        pthread_mutex_unlock(&offloadLock);
+        job->result = job->fn(job->arg);
+        job->error = errno;
+        caller = job->caller; // the job is gone once done is seen
+        atomic_store(&job->done, 1);
+        thread_unpark(caller);
+        pthread_mutex_lock(&offloadLock);
+    }
+    return NULL;
+}
+
+/*
+ * Starts a helper, with every signal blocked. The lock must be held.
+ */
+static void offloadStartHelper() {
+    sigset_t all, old;
+    pthread_t helper;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (pthread_create(&helper, NULL, offloadHelper, NULL) != 0) {
+        perror("creating offload helper");
+        exit(EXIT_FAILURE);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_detach(helper);
+    offloadHelpers++;
+}
+
+/*
+ * Runs fn(arg) on a helper pthread, the calling thread parked meanwhile,
+ * and returns its result with errno as fn left it. Outside a thread, or in
+ * a coroutine, which cannot park, fn is just called.
+ */
+void *thread_offload(void *(*fn)(void *), void *arg) {
+    Thread self = thread_self();
+    OffloadJob job;
+
+    if (self == NULL || self == mainThread || self->stackless) return fn(arg);
+    job.next = NULL;
+    job.fn = fn;
+    job.arg = arg;
+    job.caller = thread_handle(self);
+    atomic_init(&job.done, 0);
+    preempt_disable(); // no switch while the lock is held, the next thread may want it
+    pthread_mutex_lock(&offloadLock);
+    if (offloadTail == NULL) offloadHead = &job;
+    else offloadTail->next = &job;
+    offloadTail = &job;
+    if (offloadIdle > 0) pthread_cond_signal(&offloadWork);
+    else if (offloadHelpers < offloadMax) offloadStartHelper();
+    pthread_mutex_unlock(&offloadLock);
+    preempt_enable();
+    while (!atomic_load(&job.done)) thread_park();
+    errno = job.error;
+    return job.result;
+}
+
+/*
+ * Sets how many helpers may be started, at least 1. Ones already started
+ * beyond that keep running.
+ */
+void thread_offload_helpers(int count) {
+    pthread_mutex_lock(&offloadLock);
+    offloadMax = count < 1 ? 1 : count;
+    pthread_mutex_unlock(&offloadLock);
+}
+
+static void *offloadOpen(void *arg) {
+    OffloadCall *call = arg;
+    return (void *) (long) open(call->path, call->flags, call->mode);
+}
+
+static void *offloadPread(void *arg) {
+    OffloadCall *call = arg;
+    return (void *) (long) pread(call->fd, call->buf, call->count, call->offset);
+}
+
+static void *offloadPwrite(void *arg) {
+    OffloadCall *call = arg;
+    return (void *) (long) pwrite(call->fd, call->buf, call->count, call->offset);
+}
+
+static void *offloadFsync(void *arg) {
+    OffloadCall *call = arg;
+    return (void *) (long) fsync(call->fd);
+}
+
+static void *offloadStat(void *arg) {
+    OffloadCall *call = arg;
+    return (void *) (long) stat(call->path, call->st);
+}
+
+int thread_open(const char *path, int flags, mode_t mode) {
+    OffloadCall call = { .path = path, .flags = flags, .mode = mode };
+    return (int) (long) thread_offload(offloadOpen, &call);
+}
+
+ssize_t thread_pread(int fd, void *buf, size_t count, off_t offset) {
+    OffloadCall call = { .fd = fd, .buf = buf, .count = count, .offset = offset };
+    return (ssize_t) (long) thread_offload(offloadPread, &call);
+}
+
+ssize_t thread_pwrite(int fd, const void *buf, size_t count, off_t offset) {
+    OffloadCall call = { .fd = fd, .buf = (void *) buf, .count = count, .offset = offset };
+    return (ssize_t) (long) thread_offload(offloadPwrite, &call);
+}
+
+int thread_fsync(int fd) {
+    OffloadCall call = { .fd = fd };
+    return (int) (long) thread_offload(offloadFsync, &call);
+}
+
+int thread_stat(const char *path, struct stat *st) {
+    OffloadCall call = { .path = path, .st = st };
+    return (int) (long) thread_offload(offloadStat, &call);
+}
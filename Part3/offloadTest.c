@@ -0,0 +1,102 @@
+/*
+ ============================================================================
+ Name        : offloadTest.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Offloading blocking calls. SLOW threads each offload CALLS
+               calls that sleep 100ms, which the helper pthreads must run
+               side by side while a CPU-bound thread goes on running, never
+               held up for MAX_GAP. Meanwhile a thread writes, syncs, reads
+               back and stats a file through the offloaded wrappers, and
+               opens one that is not there, which must fail with ENOENT
+               (errno is not cleared first, see littleThread.h).
+               Exits with 0 if all is well. With an argument, runs on that
+               many workers.
+               gcc -O2 offloadTest.c -o offloadTest && ./offloadTest [workers]
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "littleThread.h"
+#include "littleThread.c"
+
+#define SLOW 4
+#define CALLS 5
+#define MAX_GAP 50000000LL // half a slow call
+
+atomic_int slowDone;
+long long maxGap;
+int failed;
+
+void *slowCall(void *arg) {
+    usleep(100000);
+    return arg;
+}
+
+void slow(void *arg) {
+    for (int i = 0; i < CALLS; i++) {
+        if (thread_offload(slowCall, arg) != arg) failed = 1;
+    }
+    atomic_fetch_add(&slowDone, 1);
+}
+
+void spinner(void *arg) {
+    long long last = thread_now();
+
+    while (atomic_load(&slowDone) < SLOW) {
+        long long now = thread_now();
+        if (now - last > maxGap) maxGap = now - last;
+        last = now;
+    }
+}
+
+void fail(const char *what) {
+    printf("%s wrong\n", what);
+    failed = 1;
+}
+
+void files(void *arg) {
+    char path[64], buf[16];
+    struct stat st;
+    int fd;
+
+    sprintf(path, "/tmp/offloadTest.%d", getpid());
+    if ((fd = thread_open(path, O_CREAT | O_RDWR | O_TRUNC, 0600)) < 0) {
+        perror("opening test file");
+        failed = 1;
+        return;
+    }
+    if (thread_pwrite(fd, "hello offload", 13, 0) != 13) fail("pwrite");
+    if (thread_fsync(fd) != 0) fail("fsync");
+    memset(buf, 0, sizeof(buf));
+    if (thread_pread(fd, buf, 5, 6) != 5 || strcmp(buf, "offlo") != 0) fail("pread");
+    if (thread_stat(path, &st) != 0 || st.st_size != 13) fail("stat");
+    if (thread_open("/nonexistent/offloadTest", O_RDONLY, 0) != -1 || errno != ENOENT) fail("errno");
+    close(fd);
+    unlink(path);
+}
+
+int main(int argc, char **argv) {
+    int workerThreads = argc > 1 ? atoi(argv[1]) : 0;
+    long long start, elapsed;
+    struct stat st;
+
+    threadInit();
+    for (long i = 0; i < SLOW; i++) thread_spawn(slow, (void *) (i + 1));
+    thread_spawn(spinner, NULL);
+    thread_spawn(files, NULL);
+    start = thread_now();
+    if (workerThreads > 0) threadRunWorkers(workerThreads);
+    else setUpTimer();
+    elapsed = thread_now() - start;
+    printf("%d slow calls in %.0f ms (%d ms one at a time), spinner held up %.1f ms at most\n",
+            SLOW * CALLS, elapsed / 1e6, SLOW * CALLS * 100, maxGap / 1e6);
+    if (elapsed > SLOW * CALLS * 100000000LL * 3 / 4 || maxGap > MAX_GAP) failed = 1;
+    if (thread_stat("/tmp", &st) != 0) fail("stat outside the runtime"); // called directly
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,283 @@
+/*
+ ============================================================================
+ Name        : policy.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Scheduling policies, in single mode. A policy keeps the
+               READY best-effort threads and picks which runs next, and is
+               told of each tick, yield and block; the runtime keeps
+               readyCount and puts deadline threads (edf.c) before it.
+               Shipped: "mlfq", the multi-level feedback queue and the
+               default; "fifo", which never preempts, so a thread runs
+               until it blocks, yields or finishes, as in Part1 and Part2;
+               "rr", one queue preempted every quantum; and "random",
+               which picks any READY thread with equal chance, so every
+               thread gets its share on average and none can be starved
+               by the order of the others.
+               The policy is chosen with thread_set_policy(), or by name in
+               the THREAD_POLICY environment variable when threadInit runs,
+               so policies can be compared on the same program without
+               rebuilding it. In M:N mode the workers' deques are used.
+ ============================================================================
+ */
+
+static Thread readyHead[PRIORITIES]; // mlfq: READY threads of each priority in the order they run, linked by readyNext
+static Thread readyTail[PRIORITIES];
+static Thread readyWoken[PRIORITIES]; // the last woken thread at the front of each level
+static unsigned int readyLevels = 0; // bit p set when priority p has READY threads
+static long long lastBoost = 0; // thread_now() at the last priority boost
+
+static Thread queueHead = NULL, queueTail = NULL; // fifo and rr: READY threads, linked by readyNext
+
+static Thread *randomReady = NULL; // random: READY threads, in no order
+static int randomCount = 0, randomCapacity = 0;
+static unsigned long long pickState = 0x9e3779b97f4a7c15ULL; // xorshift64*
+
+/*
+ * Multi-level feedback queue. A thread that uses up the slice of its
+ * priority drops a level, one that yields first keeps its level, and a
+ * thread with a higher priority than the running one takes over on the
+ * next tick. Every BOOST_INTERVAL all threads go back to their base priority.
+ * A thread that blocked goes ahead of the others at its level when it
+ * wakes, behind only those woken before it, so boosted CPU-bound threads
+ * cannot make it wait a slice for each of them.
+ */
+static void mlfqEnqueue(Thread thread) {
+    int p = thread->priority;
+    Thread after = thread->woken ? readyWoken[p] : readyTail[p];
+
+    if (thread->woken) readyWoken[p] = thread;
+    if (after == NULL) { // at the front
+        thread->readyNext = readyHead[p];
+        readyHead[p] = thread;
+    } else {
+        thread->readyNext = after->readyNext;
+        after->readyNext = thread;
+    }
+    if (thread->readyNext == NULL) readyTail[p] = thread;
+    readyLevels |= 1u << p;
+}
+
+static Thread mlfqDequeue() {
+    Thread thread;
+    int p;
+
+    if (readyLevels == 0) return NULL;
+    p = __builtin_ctz(readyLevels);
+    thread = readyHead[p];
+    readyHead[p] = thread->readyNext;
+    if (readyWoken[p] == thread) readyWoken[p] = NULL;
+    thread->woken = 0;
+    if (readyHead[p] == NULL) {
+        readyTail[p] = NULL;
+        readyLevels &= ~(1u << p);
+    }
+    return thread;
+}
+
+static int mlfqRemove(Thread thread) {
+    int p = thread->priority;
+    Thread prev = NULL, t = readyHead[p];
+
+    while (t != NULL && t != thread) {
+        prev = t;
+        t = t->readyNext;
+    }
+    if (t == NULL) return 0;
+    if (prev == NULL) readyHead[p] = thread->readyNext;
+    else prev->readyNext = thread->readyNext;
+    if (readyTail[p] == thread) readyTail[p] = prev;
+    if (readyWoken[p] == thread) readyWoken[p] = prev; // the woken are all in front of it
+    if (readyHead[p] == NULL) readyLevels &= ~(1u << p);
+    return 1;
+}
+
+/*
+ * Time slice of a priority in slices of sliceLength, doubling at each
+ * level down.
+ */
+static int sliceTicks(int priority) {
+    return 1 << priority;
+}
+
+/*
+ * Moves every thread back up to its base priority so that CPU-bound
+ * threads which sank to the bottom are not starved forever.
+ */
+static void boostPriorities() {
+    Thread ready = NULL, last = NULL, thread;
+
+    while ((thread = mlfqDequeue()) != NULL) { // keep the run order
+        thread->readyNext = NULL;
+        if (last == NULL) ready = thread;
+        else last->readyNext = thread;
+        last = thread;
+    }
+    if ((thread = headOfList) != NULL) {
+        do {
+            thread->priority = thread->basePriority;
+            thread->ticks = 0;
+            thread = thread->next;
+        } while (thread != headOfList);
+    }
+    while (ready != NULL) {
+        thread = ready;
+        ready = ready->readyNext;
+        mlfqEnqueue(thread);
+    }
+    lastBoost = thread_now();
+}
+
+static void mlfqBlock(Thread thread) {
+    thread->woken = 1;
+}
+
+static int mlfqTick(Thread thread, int quantumTick) {
+    if (quantumTick && thread_now() - lastBoost >= BOOST_INTERVAL) boostPriorities();
+    if (quantumTick && ++thread->ticks >= sliceTicks(thread->priority)) {
+        if (thread->priority < PRIORITIES - 1) thread->priority++;
+        thread->ticks = 0;
+        return 1;
+    }
+    return (readyLevels & ((1u << thread->priority) - 1)) != 0; // a higher priority is waiting
+}
+
+/*
+ * One queue in the order threads became READY, for fifo and rr.
+ */
+static void queueEnqueue(Thread thread) {
+    thread->readyNext = NULL;
+    if (queueTail == NULL) queueHead = thread;
+    else queueTail->readyNext = thread;
+    queueTail = thread;
+}
+
+static Thread queueDequeue() {
+    Thread thread = queueHead;
+
+    if (thread == NULL) return NULL;
+    if ((queueHead = thread->readyNext) == NULL) queueTail = NULL;
+    return thread;
+}
+
+static int queueRemove(Thread thread) {
+    Thread prev = NULL, t = queueHead;
+
+    while (t != NULL && t != thread) {
+        prev = t;
+        t = t->readyNext;
+    }
+    if (t == NULL) return 0;
+    if (prev == NULL) queueHead = thread->readyNext;
+    else prev->readyNext = thread->readyNext;
+    if (queueTail == thread) queueTail = prev;
+    return 1;
+}
+
+static int fifoTick(Thread thread, int quantumTick) {
+    return 0;
+}
+
+/*
+ * rr and random: a thread is switched out once it has run a whole quantum,
+ * counted in its own ticks, so one that yields or blocks starts afresh.
+ */
+static int sliceTick(Thread thread, int quantumTick) {
+    if (++thread->ticks < ticksPerQuantum) return 0;
+    thread->ticks = 0;
+    return 1;
+}
+
+static void sliceReset(Thread thread) {
+    thread->ticks = 0;
+}
+
+/*
+ * random: any READY thread is as likely to be picked as any other.
+ * The array only ever grows, so enqueueing rarely allocates.
+ */
+static void randomEnqueue(Thread thread) {
+    if (randomCount == randomCapacity) {
+        randomCapacity = randomCapacity ? randomCapacity * 2 : 64;
+        if ((randomReady = realloc(randomReady, sizeof(Thread) * randomCapacity)) == NULL) {
+            perror("growing ready array");
+            exit(EXIT_FAILURE);
+        }
+    }
+    randomReady[randomCount++] = thread;
+}
+
+static Thread randomDequeue() {
+    Thread thread;
+    int i;
+
+    if (randomCount == 0) return NULL;
+    pickState ^= pickState >> 12;
+    pickState ^= pickState << 25;
+    pickState ^= pickState >> 27;
+    i = (int) (((pickState * 0x2545f4914f6cdd1dULL) >> 32) * randomCount >> 32);
+    thread = randomReady[i];
+    randomReady[i] = randomReady[--randomCount];
+    return thread;
+}
+
+static int randomRemove(Thread thread) {
+    for (int i = 0; i < randomCount; i++) {
+        if (randomReady[i] == thread) {
+            randomReady[i] = randomReady[--randomCount];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static const SchedPolicy mlfqPolicy = { "mlfq", mlfqEnqueue, mlfqDequeue, mlfqRemove, mlfqTick, NULL, mlfqBlock };
+static const SchedPolicy fifoPolicy = { "fifo", queueEnqueue, queueDequeue, queueRemove, fifoTick, NULL, NULL };
+static const SchedPolicy rrPolicy = { "rr", queueEnqueue, queueDequeue, queueRemove, sliceTick, sliceReset, sliceReset };
+static const SchedPolicy randomPolicy = { "random", randomEnqueue, randomDequeue, randomRemove, sliceTick, sliceReset, sliceReset };
+static const SchedPolicy *policies[] = { &mlfqPolicy, &fifoPolicy, &rrPolicy, &randomPolicy };
+
+static const SchedPolicy *policy = &mlfqPolicy;
+
+/*
+ * Makes next the policy, handing it the READY threads in the order the
+ * old one would have run them. Single mode, not from a tick.
+ */
+void thread_set_policy_ops(const SchedPolicy *next) {
+    Thread ready = NULL, last = NULL, thread;
+
+    preempt_disable();
+    while ((thread = policy->dequeue()) != NULL) {
+        thread->readyNext = NULL;
+        if (last == NULL) ready = thread;
+        else last->readyNext = thread;
+        last = thread;
+    }
+    policy = next;
+    while (ready != NULL) {
+        thread = ready;
+        ready = ready->readyNext;
+        thread->ticks = 0;
+        thread->woken = 0;
+        policy->enqueue(thread);
+    }
+    preempt_enable();
+}
+
+/*
+ * Picks a shipped policy by name. Returns -1, changing nothing, if there
+ * is none of that name.
+ */
+int thread_set_policy(const char *name) {
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcmp(policies[i]->name, name) == 0) {
+            thread_set_policy_ops(policies[i]);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *thread_policy_name() {
+    return policy->name;
+}
@@ -0,0 +1,91 @@
+/*
+ ============================================================================
+ Name        : preemptBench.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : The threads3.c workload with rand() guarded two ways.
+               Three threads run wasteTime(20) five times each, first with
+               signalsOff()/signalsOn() (two sigprocmask calls per rand),
+               then with preempt_disable()/preempt_enable(), and then
+               as it is now, with the per-thread thread_random().
+               gcc -O2 preemptBench.c -o preemptBench && ./preemptBench
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include "littleThread.h"
+#include "threads3.c"
+#include "littleThread.c"
+
+#define CALLS 5
+#define NUMBER 20
+
+/*
+ * wasteTime() as it was before preempt_disable().
+ */
+int wasteTimeMasked(int number) {
+    int i, j;
+    int result = 0;
+
+    for (i = 0; i < 10000; i++)
+        for (j = 0; j < number; j++) {
+            signalsOff();
+            result = rand();
+            signalsOn();
+        }
+    return result;
+}
+
+/*
+ * wasteTime() as it was before thread_random().
+ */
+int wasteTimeGuarded(int number) {
+    int i, j;
+    int result = 0;
+
+    for (i = 0; i < 10000; i++)
+        for (j = 0; j < number; j++) {
+            preempt_disable();
+            result = rand();
+            preempt_enable();
+        }
+    return result;
+}
+
+void masked(void *arg) {
+    for (int i = 0; i < CALLS; i++) wasteTimeMasked(NUMBER);
+}
+
+void guarded(void *arg) {
+    for (int i = 0; i < CALLS; i++) wasteTimeGuarded(NUMBER);
+}
+
+void perThread(void *arg) {
+    for (int i = 0; i < CALLS; i++) wasteTime(NUMBER);
+}
+
+double run(void (*fn)(void *)) {
+    double start;
+
+    for (int t = 0; t < 3; t++) thread_spawn(fn, NULL);
+    start = thread_now();
+    setUpTimer();
+    return thread_now() - start;
+}
+
+int main(void) {
+    double calls = 3.0 * CALLS * 10000 * NUMBER;
+    double before, after, now;
+
+    threadInit();
+    before = run(masked);
+    after = run(guarded);
+    now = run(perThread);
+    printf("signalsOff/signalsOn:           %7.1f ms %5.1f ns/rand\n", before / 1e6, before / calls);
+    printf("preempt_disable/preempt_enable: %7.1f ms %5.1f ns/rand\n", after / 1e6, after / calls);
+    printf("thread_random:                  %7.1f ms %5.1f ns/rand\n", now / 1e6, now / calls);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,80 @@
+/*
+ ============================================================================
+ Name        : quantumBench.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Adaptive against fixed quantum.
+               Batch: four CPU-bound threads spin for a second; prints how
+               often the CPU went from one to another. Mixed: the same
+               four spin while a thread sleeps 2ms at a time; prints how
+               late it gets back on the CPU, and the spinners' switches.
+               Each runs with the adaptive slice and tick, then with a
+               fixed tick of one quantum.
+               gcc -O2 quantumBench.c -o quantumBench && ./quantumBench
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "littleThread.h"
+#include "littleThread.c"
+
+#define SPINNERS 4
+#define BATCH_NS 1000000000LL
+#define SLEEPS 300
+#define SLEEP_NS 2000000LL
+
+volatile int stop;
+volatile long spinning; // the spinner last seen running
+long long switches;
+long long maxLate, sumLate;
+
+void spinner(void *arg) {
+    long self = (long) arg;
+
+    while (!stop) {
+        if (spinning != self) { // another spinner ran since we last looked
+            spinning = self;
+            switches++;
+        }
+    }
+}
+
+void timeKeeper(void *arg) {
+    thread_sleep(BATCH_NS);
+    stop = 1;
+}
+
+void sleeper(void *arg) {
+    for (int i = 0; i < SLEEPS; i++) {
+        long long start = thread_now(), late;
+        thread_sleep(SLEEP_NS);
+        late = thread_now() - start - SLEEP_NS;
+        if (late > maxLate) maxLate = late;
+        sumLate += late;
+    }
+    stop = 1;
+}
+
+void run(void (*fn)(void *)) {
+    stop = 0;
+    switches = maxLate = sumLate = 0;
+    for (long i = 1; i <= SPINNERS; i++) thread_spawn(spinner, (void *) i);
+    thread_spawn(fn, NULL);
+    setUpTimer();
+}
+
+int main(void) {
+    threadInit();
+    for (int adaptive = 1; adaptive >= 0; adaptive--) {
+        const char *mode = adaptive ? "adaptive" : "fixed   ";
+        thread_set_adaptive_quantum(adaptive);
+        run(timeKeeper);
+        printf("%s batch: %5lld switches/s\n", mode, switches * 1000000000LL / BATCH_NS);
+        run(sleeper);
+        printf("%s mixed: late mean %6.3f ms max %6.3f ms, %lld switches\n", mode,
+                sumLate / 1e6 / SLEEPS, maxLate / 1e6, switches);
+    }
+    return EXIT_SUCCESS;
+}
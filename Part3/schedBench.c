@@ -0,0 +1,40 @@
+/*
+ ============================================================================
+ Name        : schedBench.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Scheduling cost against thread count.
+               N threads each call threadYield() in turn; prints the
+               average cost of a yield (one scheduling decision and one
+               switch) for N from 10 to 100000.
+               gcc -O2 schedBench.c -o schedBench && ./schedBench
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "littleThread.h"
+#include "littleThread.c"
+
+#define SWITCHES 2000000 // yields per run, spread over the threads
+
+int yields;
+
+void yielder(void *arg) {
+    for (int i = 0; i < yields; i++) threadYield();
+}
+
+int main(void) {
+    stackPoolConfigure(16 * 1024, -1, 0); // 100000 guarded stacks exceed vm.max_map_count
+    threadInit();
+    for (int count = 10; count <= 100000; count *= 10) {
+        yields = SWITCHES / count > 10 ? SWITCHES / count : 10;
+        for (int t = 0; t < count; t++) thread_spawn(yielder, NULL);
+        double start = thread_now();
+        setUpTimer();
+        double ns = (thread_now() - start) / ((double) count * yields);
+        printf("threads %6d: %6.1f ns/yield\n", count, ns);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,65 @@
+/*
+ ============================================================================
+ Name        : spawnBench.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Spawn latency benchmark.
+               Times thread_spawn() from main and from inside a running
+               thread (whose children get stacks back from the pool), and
+               thread_spawn_batch() from main, each into an empty pool.
+               gcc -O2 spawnBench.c -o spawnBench && ./spawnBench
+               Build with -DUSE_SETJMP as well to compare with starting
+               threads through a signal handler on their stacks.
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "littleThread.h"
+#include "littleThread.c"
+
+#define SPAWNS 10000
+
+double fromThreadNs;
+
+void nothing(void *arg) {
+}
+
+void spawner(void *arg) {
+    double start = thread_now();
+    for (int i = 0; i < SPAWNS; i++) thread_spawn(nothing, NULL);
+    fromThreadNs = (thread_now() - start) / SPAWNS;
+}
+
+/*
+ * ns per thread for thread_spawn_batch from main, the threads then run.
+ */
+double batchNs() {
+    double start = thread_now(), ns;
+    thread_spawn_batch(SPAWNS, nothing, NULL);
+    ns = (thread_now() - start) / SPAWNS;
+    setUpTimer();
+    return ns;
+}
+
+int main(void) {
+    double start, fromMainNs, batchEmptyNs, batchPooledNs;
+
+    threadInit();
+    start = thread_now();
+    for (int i = 0; i < SPAWNS; i++) thread_spawn(nothing, NULL);
+    fromMainNs = (thread_now() - start) / SPAWNS;
+    thread_spawn(spawner, NULL);
+    setUpTimer();
+
+    stackPoolConfigure(stackPoolStackSize(), -1, 1); // empty the pool again
+    batchEmptyNs = batchNs();
+    batchPooledNs = batchNs();
+
+    printf("spawn from main, empty pool:      %.0f ns\n", fromMainNs);
+    printf("spawn from thread, pooled stacks: %.0f ns\n", fromThreadNs);
+    printf("batch, empty pool:                %.0f ns\n", batchEmptyNs);
+    printf("batch, pooled stacks:             %.0f ns\n", batchPooledNs);
+    return EXIT_SUCCESS;
+}
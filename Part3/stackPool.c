@@ -0,0 +1,222 @@
+/*
+ ============================================================================
+ Name        : stackPool.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Pool of mmap'd thread stacks.
+               Each stack sits above a PROT_NONE guard page so an overflow
+               faults instead of corrupting memory. Stacks are reserved
+               with MAP_NORESERVE and their pages only committed when
+               touched, so a large stack costs address space rather than
+               memory until it is used. Sizes are rounded up to a power of
+               two pages, with a free list for each size. Finished stacks
+               go back on their list and are handed out again; stacks kept
+               beyond the trim watermark have their pages given back to
+               the kernel but keep their mapping.
+               How deep a stack has been used is read off which of its
+               pages are resident, which tells the depth of the thread on
+               it only if no thread used it before: a fresh stack, or,
+               while that is watched, a pooled one scrubbed of its pages
+               as it is handed out again. stackAlloc says which it gave.
+ ============================================================================
+ */
+
+#include <sys/mman.h>
+
+#define DEFAULT_STACKSIZE (64 * 1024)
+#define DEFAULT_TRIM_WATERMARK 64
+#define STACK_CLASSES 32 // free lists, for 1 to 2^31 pages
+
+/*
+ * A free stack. The link lives at the top of the stack, in the page every
+ * thread touches first, so it commits nothing a thread would not.
+ */
+struct freeStack {
+    struct freeStack *next;
+    void *base; // the lowest usable address
+    int used; // a thread has run on it, so pages of its may be resident
+};
+
+static size_t pageSize = 0;
+static size_t stackSize = DEFAULT_STACKSIZE; // default usable bytes, a power of two pages
+static int trimWatermark = DEFAULT_TRIM_WATERMARK; // per size, -1 never trims
+static int guardPages = 1; // each guard page costs a mapping, see vm.max_map_count
+static int scrubStacks = 0; // give back a pooled stack's pages when it is handed out
+static struct freeStack *freeStacks[STACK_CLASSES]; // by log2 of the pages
+static int freeStackCount[STACK_CLASSES];
+
+static void unmapStack(void *stack, size_t size) {
+    if (munmap((char *) stack - pageSize, size + pageSize) < 0) {
+        perror("unmapping stack");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * The free list for a size, which must be a power of two pages.
+ */
+static int stackClass(size_t size) {
+    return __builtin_ctzl(size / pageSize);
+}
+
+static struct freeStack *stackLink(void *stack, size_t size) {
+    return (struct freeStack *) ((char *) stack + size) - 1;
+}
+
+/*
+ * Rounds a requested size up to a power of two pages, 0 meaning the default.
+ */
+size_t stackRoundSize(size_t size) {
+    size_t rounded;
+
+    if (pageSize == 0) pageSize = sysconf(_SC_PAGESIZE);
+    if (size == 0) return stackSize;
+    for (rounded = pageSize; rounded < size; rounded *= 2);
+    return rounded;
+}
+
+/*
+ * Sets the default stack size, the trim watermark and whether stacks get
+ * guard pages. Without them the stacks' mappings can merge, which is
+ * needed beyond about 30000 stacks.
+ * Stacks in the free lists are unmapped.
+ */
+void stackPoolConfigure(size_t size, int watermark, int guard) {
+    if (pageSize == 0) pageSize = sysconf(_SC_PAGESIZE);
+    for (int c = 0; c < STACK_CLASSES; c++) {
+        while (freeStacks[c] != NULL) {
+            struct freeStack *link = freeStacks[c];
+            freeStacks[c] = link->next;
+            unmapStack(link->base, pageSize << c);
+        }
+        freeStackCount[c] = 0;
+    }
+    for (stackSize = pageSize; stackSize < size; stackSize *= 2);
+    trimWatermark = watermark;
+    guardPages = guard;
+}
+
+size_t stackPoolStackSize() {
+    return stackSize;
+}
+
+/*
+ * Whether stacks handed out again have their pages, bar the top one,
+ * given back first, so a high-water mark taken with stackHighWater()
+ * counts the new thread's alone. Costs an madvise per thread.
+ */
+void stackPoolScrub(int on) {
+    scrubStacks = on;
+}
+
+/*
+ * Returns the lowest usable address of a stack of size bytes, as rounded
+ * by stackRoundSize(), and sets clean to whether no earlier thread's
+ * pages are resident on it, so stackHighWater() will be the new one's.
+ */
+void *stackAlloc(size_t size, int *clean) {
+    int c = stackClass(size);
+    char *base;
+
+    if (freeStacks[c] != NULL) {
+        struct freeStack *link = freeStacks[c];
+        freeStacks[c] = link->next;
+        freeStackCount[c]--;
+        *clean = !link->used;
+        // keep the top page, the thread touches it first anyway
+        if (!*clean && scrubStacks && size > pageSize) {
+            if (madvise(link->base, size - pageSize, MADV_DONTNEED) < 0) perror("scrubbing stack");
+            else *clean = 1;
+        }
+        return link->base;
+    }
+    base = mmap(NULL, size + pageSize, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        perror("mapping stack");
+        exit(EXIT_FAILURE);
+    }
+    if (guardPages && mprotect(base, pageSize, PROT_NONE) < 0) { // the guard page
+        perror("protecting guard page");
+        exit(EXIT_FAILURE);
+    }
+    *clean = 1;
+    return base + pageSize;
+}
+
+/*
+ * Makes sure the pool has count stacks of size bytes, as rounded by
+ * stackRoundSize(), mapping those it lacks with one mmap rather than one
+ * each. Guard pages still cost an mprotect per stack.
+ */
+void stackReserve(size_t size, int count) {
+    int c = stackClass(size);
+    size_t span = size + pageSize;
+    char *base;
+
+    if ((count -= freeStackCount[c]) <= 0) return;
+    base = mmap(NULL, span * count, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        perror("mapping stacks");
+        exit(EXIT_FAILURE);
+    }
+    for (base += span * (count - 1); count > 0; count--, base -= span) { // the lowest first off the list
+        struct freeStack *link = stackLink(base + pageSize, size);
+        if (guardPages && mprotect(base, pageSize, PROT_NONE) < 0) {
+            perror("protecting guard page");
+            exit(EXIT_FAILURE);
+        }
+        link->base = base + pageSize;
+        link->used = 0;
+        link->next = freeStacks[c];
+        freeStacks[c] = link;
+        freeStackCount[c]++;
+    }
+}
+
+/*
+ * Puts a stack back in the pool. Must not be the stack we are running on
+ * when it may be trimmed, as trimming throws its contents away.
+ */
+void stackRelease(void *stack, size_t size) {
+    int c = stackClass(size);
+    struct freeStack *link = stackLink(stack, size);
+
+    if (trimWatermark >= 0 && freeStackCount[c] >= trimWatermark && size > pageSize) {
+#ifdef MADV_FREE
+        int advice = MADV_FREE;
+#else
+        int advice = MADV_DONTNEED;
+#endif
+        // keep the top page, it holds the free list link
+        if (madvise(stack, size - pageSize, advice) < 0) {
+            perror("trimming stack");
+        }
+    }
+    link->base = stack;
+    link->used = 1;
+    link->next = freeStacks[c];
+    freeStacks[c] = link;
+    freeStackCount[c]++;
+}
+
+/*
+ * Bytes from the top of the stack down to its deepest resident page, found
+ * with mincore from the bottom up: how deep the thread on it has gone, to
+ * page granularity, if stackAlloc handed it out clean, else how deep any
+ * thread on it has gone.
+ */
+size_t stackHighWater(void *stack, size_t size) {
+    unsigned char resident[256];
+    size_t pages = size / pageSize;
+
+    for (size_t first = 0; first < pages; first += sizeof(resident)) {
+        size_t count = pages - first < sizeof(resident) ? pages - first : sizeof(resident);
+        if (mincore((char *) stack + first * pageSize, count * pageSize, resident) < 0) return size;
+        for (size_t p = 0; p < count; p++) {
+            if (resident[p] & 1) return size - (first + p) * pageSize;
+        }
+    }
+    return 0;
+}
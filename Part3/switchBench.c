@@ -0,0 +1,93 @@
+/*
+ ============================================================================
+ Name        : switchBench.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Context switch microbenchmark.
+               Ping-pongs between main and a second context on its own
+               stack, first with setjmp/longjmp and then with the
+               switchContext routine from context.c, the second context
+               started by contextInit rather than a signal.
+               gcc -O2 switchBench.c -o switchBench && ./switchBench
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <memory.h>
+
+#include "littleThread.h"
+#include "context.c"
+
+#define ROUNDS 5000000
+#define STACKSIZE (64 * 1024)
+
+static jmp_buf mainEnv, otherEnv;
+static Context mainContext, otherContext;
+
+/*
+ * Runs on the new stack when SIGUSR1 is received (like associateStack).
+ */
+void jmpStart(int signum) {
+    if (setjmp(otherEnv) != 0) {
+        for (;;) {
+            if (setjmp(otherEnv) == 0) longjmp(mainEnv, 1);
+        }
+    }
+}
+
+void contextStart() {
+    for (;;) switchContext(otherContext, mainContext);
+}
+
+/*
+ * Creates the second context by taking SIGUSR1 on a fresh signal stack.
+ */
+void startOnNewStack(void (*handler)(int)) {
+    struct sigaction action;
+    stack_t stack;
+
+    if ((stack.ss_sp = malloc(STACKSIZE)) == NULL) {
+        perror("allocating stack");
+        exit(EXIT_FAILURE);
+    }
+    stack.ss_size = STACKSIZE;
+    stack.ss_flags = 0;
+    if (sigaltstack(&stack, NULL) < 0) {
+        perror("sigaltstack");
+        exit(EXIT_FAILURE);
+    }
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handler;
+    action.sa_flags = SA_ONSTACK;
+    sigaction(SIGUSR1, &action, NULL);
+    kill(getpid(), SIGUSR1);
+}
+
+double elapsedNs(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+int main(void) {
+    struct timespec start, end;
+
+    startOnNewStack(jmpStart);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ROUNDS; i++) {
+        if (setjmp(mainEnv) == 0) longjmp(otherEnv, 1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("setjmp/longjmp: %.1f ns/switch\n", elapsedNs(&start, &end) / (2.0 * ROUNDS));
+
+    contextInit(otherContext, malloc(STACKSIZE), STACKSIZE, contextStart);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ROUNDS; i++) {
+        switchContext(mainContext, otherContext);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("switchContext:  %.1f ns/switch\n", elapsedNs(&start, &end) / (2.0 * ROUNDS));
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,129 @@
+/*
+ ============================================================================
+ Name        : syncTest.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Mutexes, condition variables, semaphores and barriers.
+               THREADS threads add to a counter under a mutex, some
+               yielding while they hold it; producers and consumers hand
+               over items through a condition variable, and through a
+               semaphore; THREADS threads go through a barrier ROUNDS
+               times, none running ahead. Exits with 0 if every count
+               comes out right. With an argument, runs on that many
+               workers.
+               gcc -O2 syncTest.c -o syncTest && ./syncTest [workers]
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "littleThread.h"
+#include "littleThread.c"
+
+#define THREADS 16
+#define ADDS 20000
+#define PAIRS 4
+#define ITEMS 50000
+#define ROUNDS 500
+
+Mutex mutex = MUTEX_INITIALIZER;
+Condition nonEmpty;
+Semaphore semaphore;
+Barrier barrier;
+long counter, consumed;
+int items, failed;
+int rounds[THREADS];
+int workerThreads;
+
+void adder(void *arg) {
+    long yieldEvery = (long) arg;
+
+    for (int i = 0; i < ADDS; i++) {
+        thread_mutex_lock(&mutex);
+        counter++;
+        if (yieldEvery && i % yieldEvery == 0) threadYield();
+        thread_mutex_unlock(&mutex);
+    }
+}
+
+void producer(void *arg) {
+    for (int i = 0; i < ITEMS; i++) {
+        thread_mutex_lock(&mutex);
+        items++;
+        thread_cond_signal(&nonEmpty);
+        thread_mutex_unlock(&mutex);
+    }
+}
+
+void consumer(void *arg) {
+    for (int i = 0; i < ITEMS; i++) {
+        thread_mutex_lock(&mutex);
+        while (items == 0) thread_cond_wait(&nonEmpty, &mutex);
+        items--;
+        consumed++;
+        thread_mutex_unlock(&mutex);
+    }
+}
+
+void poster(void *arg) {
+    for (int i = 0; i < ITEMS; i++) thread_sem_post(&semaphore);
+}
+
+void taker(void *arg) {
+    for (int i = 0; i < ITEMS; i++) thread_sem_wait(&semaphore);
+}
+
+void traveller(void *arg) {
+    long self = (long) arg;
+
+    for (int r = 0; r < ROUNDS; r++) {
+        rounds[self] = r;
+        thread_barrier_wait(&barrier);
+        for (int t = 0; t < THREADS; t++) {
+            if (rounds[t] < r) failed = 1; // got through before it arrived
+        }
+        thread_barrier_wait(&barrier);
+    }
+}
+
+void run() {
+    if (workerThreads > 0) threadRunWorkers(workerThreads);
+    else setUpTimer();
+}
+
+void check(const char *what, long got, long want) {
+    printf("%-10s %ld (want %ld)\n", what, got, want);
+    if (got != want) failed = 1;
+}
+
+int main(int argc, char **argv) {
+    workerThreads = argc > 1 ? atoi(argv[1]) : 0;
+    threadInit();
+    thread_cond_init(&nonEmpty);
+    thread_sem_init(&semaphore, 0);
+    thread_barrier_init(&barrier, THREADS);
+
+    for (long i = 0; i < THREADS; i++) thread_spawn(adder, (void *) (i % 2 ? 1000L : 0L));
+    run();
+    check("mutex", counter, (long) THREADS * ADDS);
+
+    for (int i = 0; i < PAIRS; i++) {
+        thread_spawn(producer, NULL);
+        thread_spawn(consumer, NULL);
+    }
+    run();
+    check("condition", consumed, (long) PAIRS * ITEMS);
+
+    for (int i = 0; i < PAIRS; i++) {
+        thread_spawn(poster, NULL);
+        thread_spawn(taker, NULL);
+    }
+    run();
+    check("semaphore", atomic_load(&semaphore.count), 0);
+
+    for (long i = 0; i < THREADS; i++) thread_spawn(traveller, (void *) i);
+    run();
+    check("barrier", failed, 0);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
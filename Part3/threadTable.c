@@ -0,0 +1,120 @@
+/*
+ ============================================================================
+ Name        : threadTable.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : The thread table. Control blocks are allocated from
+               cache-line aligned slabs of THREAD_SLAB, which never move,
+               so a slot's index finds its control block. A finished
+               thread's block goes on a free list and is handed out again,
+               its slot's generation bumped so old handles to it are seen
+               to be stale; memory stays flat however many threads come
+               and go. The table, the free list and the slabs are guarded
+               by runtimeLock; handles are looked up without it, so new
+               slabs, the slot count and generations are published with
+               release stores and read with acquire loads.
+               A control block is recycled once its thread has finished
+               and its stack is released and, for a thread spawned by
+               thread_spawn_value, its result has been taken by a join.
+ ============================================================================
+ */
+
+#define THREAD_SLAB 256 // control blocks per slab
+#define THREAD_SLABS 65536 // slabs at most, 16M threads at once
+
+static _Atomic(Thread) threadSlabs[THREAD_SLABS];
+static Thread freeThreads = NULL; // recycled control blocks, linked by readyNext
+
+static Thread threadAt(int slot) {
+    return &atomic_load_explicit(&threadSlabs[slot / THREAD_SLAB], memory_order_acquire)[slot % THREAD_SLAB];
+}
+
+/*
+ * A control block off the free list, or the next slot never used.
+ * runtimeLock must be held.
+ */
+static Thread tableTake() {
+    int count = atomic_load_explicit(&threadCount, memory_order_relaxed);
+    Thread thread, slab;
+
+    if ((thread = freeThreads) != NULL) {
+        freeThreads = thread->readyNext;
+        return thread;
+    }
+    if (count % THREAD_SLAB == 0) {
+        if (count / THREAD_SLAB == THREAD_SLABS) {
+            fprintf(stderr, "too many threads\n");
+            exit(EXIT_FAILURE);
+        }
+        if ((slab = aligned_alloc(64, sizeof(struct thread) * THREAD_SLAB)) == NULL) {
+            perror("allocating thread slab");
+            exit(EXIT_FAILURE);
+        }
+        atomic_store_explicit(&threadSlabs[count / THREAD_SLAB], slab, memory_order_release);
+    }
+    thread = threadAt(count);
+    thread->slot = count;
+    atomic_init(&thread->generation, 1);
+    thread->stackHighWater = 0;
+    thread->stackMark = 0; // no generation's
+    atomic_init(&thread->joiners.guard, 0); // kept from here on, joiners of stale handles take it
+    atomic_store_explicit(&threadCount, count + 1, memory_order_release); // lookups may find it from here
+    return thread;
+}
+
+/*
+ * Puts a finished thread's control block on the free list, making its
+ * handles stale. runtimeLock must be held.
+ */
+static void tableRecycle(Thread thread) {
+    spinLock(&thread->joiners.guard); // joiners check the generation under it
+    atomic_fetch_add_explicit(&thread->generation, 1, memory_order_release);
+    spinUnlock(&thread->joiners.guard);
+    if (thread->stackless) free(thread->arg); // the frame
+    thread->readyNext = freeThreads;
+    freeThreads = thread;
+}
+
+/*
+ * Drops one of a finished thread's references, recycling it after the last.
+ */
+static void threadRelease(Thread thread) {
+    if (atomic_fetch_sub(&thread->refs, 1) != 1) return;
+    preempt_disable();
+    pthread_mutex_lock(&runtimeLock);
+    tableRecycle(thread);
+    pthread_mutex_unlock(&runtimeLock);
+    preempt_enable();
+}
+
+/*
+ * The control block in a handle's slot, whichever generation it is at
+ * now, or NULL if the slot was never used.
+ */
+static Thread threadSlot(ThreadHandle handle) {
+    unsigned int slot = (unsigned int) handle;
+
+    if (slot >= (unsigned int) atomic_load_explicit(&threadCount, memory_order_acquire)) return NULL;
+    return threadAt(slot);
+}
+
+/*
+ * The live thread a handle names, or NULL if it is stale. The thread may
+ * still finish and be recycled after this, which its joiners check for
+ * under its joiners' guard.
+ */
+static Thread threadLookup(ThreadHandle handle) {
+    Thread thread = threadSlot(handle);
+
+    if (thread == NULL) return NULL;
+    return atomic_load_explicit(&thread->generation, memory_order_acquire) == (unsigned int) (handle >> 32) ? thread : NULL;
+}
+
+/*
+ * A handle to thread. NULL, as thread_self() gives outside a thread, has
+ * handle 0, which names no thread, as generations start at 1.
+ */
+ThreadHandle thread_handle(Thread thread) {
+    if (thread == NULL) return 0;
+    return (ThreadHandle) thread->generation << 32 | (unsigned int) thread->slot;
+}
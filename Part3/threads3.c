@@ -32,9 +32,7 @@ int wasteTime(int number) {
 
 	for (i = 0; i < 10000; i++)
 		for (j = 0; j < number; j++) {
-			signalsOff();
-			result = rand();
-			signalsOn();
+			result = (int) (thread_random() >> 33); // rand() is not thread-safe, this is per thread
 		}
 	return result;
 }
@@ -0,0 +1,263 @@
+/*
+ ============================================================================
+ Name        : timers.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Sleeping and runtime timers on a hierarchical timer wheel.
+               Time is counted in ticks of 2^20 ns (about 1 ms). Level 0
+               has a slot for each of the next 64 ticks, each level above
+               covers 64 times the span of the one below, and a timer is
+               moved down a level when the wheel comes round to its slot.
+               Adding and cancelling are O(1) and nothing is allocated, the
+               timers live in their owners (a sleeping thread's is in its
+               control block). A timer fires once its whole tick has passed,
+               so up to a tick late but never early.
+               The wheel is advanced by runTimers(), called from the
+               preemption tick, the idle loop and the worker loops, each
+               with preemption disabled.
+ ============================================================================
+ */
+
+#include <time.h>
+#include <sys/select.h>
+
+#define WHEEL_SHIFT 20 // ns per tick, as a power of two
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS) // slots per level
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4 // 64^4 ticks, about 5 hours, later timers wait in the top level
+
+static Timer *wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static unsigned long long wheelOccupied[WHEEL_LEVELS]; // bit s set when slot s is not empty
+static unsigned long long wheelNow = 0; // the next tick to process
+static atomic_int pendingTimers = 0;
+static atomic_int wheelLock = 0; // held with preemption disabled
+
+long long thread_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/*
+ * The wheel lock must be held for these.
+ */
+static void wheelAdd(Timer *timer) {
+    unsigned long long tick = (unsigned long long) timer->expires >> WHEEL_SHIFT;
+    unsigned long long delta;
+    int level = 0;
+
+    if (tick < wheelNow) tick = wheelNow;
+    delta = tick - wheelNow;
+    while (level < WHEEL_LEVELS - 1 && delta >> (WHEEL_BITS * (level + 1)) != 0) level++;
+    if (delta >> (WHEEL_BITS * WHEEL_LEVELS) != 0) { // past the top, wait in its last slot
+        tick = wheelNow + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    }
+    timer->level = level;
+    timer->slot = (tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    timer->next = wheel[level][timer->slot];
+    if (timer->next != NULL) timer->next->pprev = &timer->next;
+    timer->pprev = &wheel[level][timer->slot];
+    *timer->pprev = timer;
+    wheelOccupied[level] |= 1ULL << timer->slot;
+    timer->pending = 1;
+    atomic_fetch_add_explicit(&pendingTimers, 1, memory_order_relaxed);
+}
+
+static void wheelRemove(Timer *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next != NULL) timer->next->pprev = timer->pprev;
+    if (wheel[timer->level][timer->slot] == NULL) {
+        wheelOccupied[timer->level] &= ~(1ULL << timer->slot);
+    }
+    timer->pending = 0;
+    atomic_fetch_sub_explicit(&pendingTimers, 1, memory_order_relaxed);
+}
+
+/*
+ * With nothing pending the wheel is not advanced, so bring it up to now
+ * before adding to it.
+ */
+static void wheelCatchUp(long long now) {
+    if (atomic_load_explicit(&pendingTimers, memory_order_relaxed) == 0) {
+        wheelNow = (unsigned long long) now >> WHEEL_SHIFT;
+    }
+}
+
+/*
+ * Re-adds the timers of a slot, which all end up on lower levels.
+ */
+static void wheelCascade(int level, int slot) {
+    Timer *timer = wheel[level][slot];
+
+    wheel[level][slot] = NULL;
+    wheelOccupied[level] &= ~(1ULL << slot);
+    while (timer != NULL) {
+        Timer *next = timer->next;
+        atomic_fetch_sub_explicit(&pendingTimers, 1, memory_order_relaxed);
+        wheelAdd(timer);
+        timer = next;
+    }
+}
+
+/*
+ * Processes every tick before nowTick, moving the timers that are due onto
+ * the fired list. Periodic timers are re-armed here, so cancelling one from
+ * its callback works.
+ */
+static Timer *wheelAdvance(unsigned long long nowTick, long long now) {
+    Timer *fired = NULL;
+
+    while (wheelNow < nowTick && atomic_load_explicit(&pendingTimers, memory_order_relaxed) > 0) {
+        int slot = wheelNow & WHEEL_MASK;
+        Timer *timer;
+
+        if (slot == 0) { // level 0 came round, bring the next span down
+            for (int level = 1; level < WHEEL_LEVELS; level++) {
+                int upper = (wheelNow >> (WHEEL_BITS * level)) & WHEEL_MASK;
+                wheelCascade(level, upper);
+                if (upper != 0) break;
+            }
+        }
+        while ((timer = wheel[0][slot]) != NULL) {
+            wheelRemove(timer);
+            timer->firedNext = fired;
+            fired = timer;
+            if (timer->period > 0) {
+                timer->expires += ((now - timer->expires) / timer->period + 1) * timer->period;
+                wheelAdd(timer);
+            }
+        }
+        if (wheelOccupied[0] == 0) { // skip to the next cascade
+            wheelNow = (wheelNow | WHEEL_MASK) + 1;
+            if (wheelNow > nowTick) wheelNow = nowTick;
+        } else {
+            wheelNow++;
+        }
+    }
+    if (atomic_load_explicit(&pendingTimers, memory_order_relaxed) == 0) wheelNow = nowTick;
+    return fired;
+}
+
+/*
+ * Fires the timers that are due. Preemption must be disabled.
+ * Costs a load when no timer is pending.
+ */
+static void runTimers() {
+    Timer *fired;
+    long long now;
+
+    if (atomic_load_explicit(&pendingTimers, memory_order_relaxed) == 0) return;
+    now = thread_now();
+    spinLock(&wheelLock);
+    fired = wheelAdvance((unsigned long long) now >> WHEEL_SHIFT, now);
+    spinUnlock(&wheelLock);
+    while (fired != NULL) { // not under the lock, callbacks may start timers
+        Timer *next = fired->firedNext;
+        fired->callback(fired->arg);
+        fired = next;
+    }
+}
+
+/*
+ * Sets timeout to the time until the next tick with something to do,
+ * either a timer to fire or a slot to cascade. 0 if no timer is pending.
+ */
+static int nextTimerTimeout(struct timespec *timeout) {
+    unsigned long long next = ~0ULL;
+    long long ns;
+
+    if (atomic_load_explicit(&pendingTimers, memory_order_relaxed) == 0) return 0;
+    spinLock(&wheelLock);
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        int shift = WHEEL_BITS * level;
+        int current = (wheelNow >> shift) & WHEEL_MASK;
+        unsigned long long occupied = wheelOccupied[level];
+        unsigned long long distance, tick;
+
+        if (occupied == 0) continue;
+        occupied = current == 0 ? occupied
+                : occupied >> current | occupied << (WHEEL_SIZE - current); // from current on
+        if (level == 0 || (wheelNow & ((1ULL << shift) - 1)) == 0) {
+            distance = __builtin_ctzll(occupied); // the current slot is still to be processed
+        } else { // the current slot was cascaded already, what is in it has wrapped
+            distance = (occupied & ~1ULL) != 0 ? __builtin_ctzll(occupied & ~1ULL) : WHEEL_SIZE;
+        }
+        tick = level == 0 ? wheelNow + distance : ((wheelNow >> shift) + distance) << shift;
+        if (tick < next) next = tick;
+    }
+    spinUnlock(&wheelLock);
+    ns = (long long) ((next + 1) << WHEEL_SHIFT) - thread_now(); // once that tick has passed
+    if (ns < 0) ns = 0;
+    timeout->tv_sec = ns / 1000000000LL;
+    timeout->tv_nsec = ns % 1000000000LL;
+    return 1;
+}
+
+/*
+ * Arms timer to call callback(arg) delay ns from now, then every period ns
+ * if period is not 0. A pending timer is re-armed. The callback runs in the
+ * scheduler with preemption disabled and must not block.
+ */
+void thread_timer_start(Timer *timer, long long delay, long long period,
+        void (*callback)(void *arg), void *arg) {
+    preempt_disable();
+    spinLock(&wheelLock);
+    if (timer->pending) wheelRemove(timer);
+    timer->expires = thread_now() + delay;
+    wheelCatchUp(timer->expires - delay);
+    timer->period = period;
+    timer->callback = callback;
+    timer->arg = arg;
+    wheelAdd(timer);
+    spinUnlock(&wheelLock);
+    if (workerCount == 0 && currentThread != mainThread) updateTimer(); // ticks to fire it on
+    preempt_enable();
+}
+
+/*
+ * 0 if the timer was not pending, it may be firing right now.
+ */
+int thread_timer_cancel(Timer *timer) {
+    int pending;
+
+    preempt_disable();
+    spinLock(&wheelLock);
+    if ((pending = timer->pending)) wheelRemove(timer);
+    spinUnlock(&wheelLock);
+    preempt_enable();
+    return pending;
+}
+
+static void wakeSleeper(void *arg) {
+    threadWake(arg);
+}
+
+/*
+ * The thread is BLOCKED until its timer fires. It parks on the wheel lock,
+ * so the timer cannot fire before it is switched out.
+ */
+void thread_sleep_until(long long deadline) {
+    Thread self;
+    long long now;
+
+    preempt_disable();
+    self = thread_self();
+    spinLock(&wheelLock);
+    if (deadline > (now = thread_now())) {
+        wheelCatchUp(now);
+        self->sleepTimer.expires = deadline;
+        self->sleepTimer.period = 0;
+        self->sleepTimer.callback = wakeSleeper;
+        self->sleepTimer.arg = self;
+        wheelAdd(&self->sleepTimer);
+        threadPark(&wheelLock);
+    } else {
+        spinUnlock(&wheelLock);
+    }
+    preempt_enable();
+}
+
+void thread_sleep(long long ns) {
+    thread_sleep_until(thread_now() + ns);
+}
@@ -0,0 +1,165 @@
+/*
+ ============================================================================
+ Name        : trace.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : Event tracing. While on, switch, create, finish, block,
+               wake and deadline miss events go into a global ring buffer,
+               the oldest being overwritten once it is full. Writers
+               claim a slot with one atomic increment, so workers can
+               record at the same time and nothing is taken in the signal
+               handler's path.
+               Timestamps are the TSC on x86-64, converted to ns on export
+               against CLOCK_MONOTONIC, or CLOCK_MONOTONIC elsewhere.
+               thread_trace_export() writes the buffer in the Chrome trace
+               event format, which Perfetto and chrome://tracing load.
+               Off, each trace point costs a load and a branch; with
+               -DNO_TRACE it is compiled out.
+ ============================================================================
+ */
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#define TRACE_NOBODY -2 // no thread, a worker's own loop
+
+static int workerId();
+
+enum traceType { TRACE_SWITCH, TRACE_CREATE, TRACE_FINISH, TRACE_BLOCK, TRACE_WAKE, TRACE_MISS };
+
+typedef struct traceEvent {
+    unsigned long long time; // traceClock()
+    short type; // enum traceType
+    short worker; // 0 outside M:N mode
+    int tid; // the thread, for a switch the one switched from
+    int other; // switched to, or the creating thread
+} TraceEvent;
+
+static int traceEnabled = 0;
+static TraceEvent *traceRing = NULL;
+static unsigned long traceMask = 0; // ring size - 1
+static atomic_ulong traceHead = 0; // events recorded, the next goes at traceHead & traceMask
+static unsigned long long traceStartClock, traceStopClock; // the clock, and
+static long long traceStartNs, traceStopNs; // CLOCK_MONOTONIC, when started and stopped
+
+#ifdef NO_TRACE
+#define TRACE(type, tid, other) do { } while (0)
+#else
+#define TRACE(type, tid, other) do { if (traceEnabled) traceRecord(type, tid, other); } while (0)
+#endif
+
+static inline unsigned long long traceClock() {
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return thread_now();
+#endif
+}
+
+static void traceRecord(int type, int tid, int other) {
+    unsigned long index = atomic_fetch_add_explicit(&traceHead, 1, memory_order_relaxed);
+    TraceEvent *event = &traceRing[index & traceMask];
+
+    event->time = traceClock();
+    event->type = type;
+    event->worker = workerId();
+    event->tid = tid;
+    event->other = other;
+}
+
+/*
+ * Starts recording into a fresh ring of at least events events.
+ */
+void thread_trace_start(unsigned long events) {
+    unsigned long size = 1024;
+
+    traceEnabled = 0;
+    while (size < events) size *= 2;
+    free(traceRing);
+    if ((traceRing = malloc(sizeof(TraceEvent) * size)) == NULL) {
+        perror("allocating trace buffer");
+        exit(EXIT_FAILURE);
+    }
+    traceMask = size - 1;
+    atomic_store(&traceHead, 0);
+    traceStartNs = thread_now();
+    traceStartClock = traceClock();
+    traceEnabled = 1;
+}
+
+void thread_trace_stop() {
+    if (!traceEnabled) return;
+    traceEnabled = 0;
+    traceStopNs = thread_now();
+    traceStopClock = traceClock();
+}
+
+/*
+ * Nanoseconds since the trace started.
+ */
+static double traceNs(unsigned long long time) {
+#if defined(__x86_64__)
+    if (traceStopClock == traceStartClock) return 0;
+    return (double) (time - traceStartClock) * (traceStopNs - traceStartNs)
+            / (double) (traceStopClock - traceStartClock);
+#else
+    return (double) (time - traceStartClock);
+#endif
+}
+
+static void traceWriteEvent(FILE *out, const char *name, const char *phase, int tid,
+        double ns, int worker, int other) {
+    fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%.3f",
+            name, phase, tid + 1, ns / 1000); // main, tid -1, is track 0
+    if (*phase == 'i') fprintf(out, ",\"s\":\"t\"");
+    fprintf(out, ",\"args\":{\"worker\":%d", worker);
+    if (other != TRACE_NOBODY) fprintf(out, ",\"other\":%d", other);
+    fprintf(out, "}}");
+}
+
+/*
+ * Writes the events still in the ring to path as Chrome trace JSON, each
+ * thread a track with its running time as slices. Stops the trace.
+ * Returns -1 if the file cannot be written.
+ */
+int thread_trace_export(const char *path) {
+    unsigned long head = atomic_load(&traceHead);
+    unsigned long first = head > traceMask + 1 ? head - traceMask - 1 : 0;
+    FILE *out;
+
+    thread_trace_stop();
+    if ((out = fopen(path, "w")) == NULL) return -1;
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"main\"}}");
+    for (unsigned long i = first; i < head; i++) {
+        TraceEvent *event = &traceRing[i & traceMask];
+        double ns = traceNs(event->time);
+
+        switch (event->type) {
+        case TRACE_SWITCH:
+            if (event->tid != TRACE_NOBODY) traceWriteEvent(out, "run", "E", event->tid, ns, event->worker, TRACE_NOBODY);
+            if (event->other != TRACE_NOBODY) traceWriteEvent(out, "run", "B", event->other, ns, event->worker, TRACE_NOBODY);
+            break;
+        case TRACE_CREATE:
+            fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                    event->tid + 1, event->tid);
+            traceWriteEvent(out, "create", "i", event->tid, ns, event->worker, event->other);
+            break;
+        case TRACE_FINISH:
+            traceWriteEvent(out, "finish", "i", event->tid, ns, event->worker, TRACE_NOBODY);
+            break;
+        case TRACE_BLOCK:
+            traceWriteEvent(out, "block", "i", event->tid, ns, event->worker, TRACE_NOBODY);
+            break;
+        case TRACE_WAKE:
+            traceWriteEvent(out, "wake", "i", event->tid, ns, event->worker, TRACE_NOBODY);
+            break;
+        case TRACE_MISS:
+            traceWriteEvent(out, "deadline miss", "i", event->tid, ns, event->worker, TRACE_NOBODY);
+            break;
+        }
+    }
+    fprintf(out, "\n]}\n");
+    return fclose(out) == 0 ? 0 : -1;
+}
@@ -0,0 +1,59 @@
+/*
+ ============================================================================
+ Name        : wakeLatencyTest.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : A thread waking from a sleep must get back on the CPU within
+               a bounded time however many CPU-bound threads there are,
+               priority boosts included. With 2, 8 and 32 spinners, a
+               thread sleeps 2ms at a time for 3 seconds, spanning several
+               boosts; exits with 0 if it was never more than MAX_LATE
+               late, under the default mlfq policy.
+               gcc -O2 wakeLatencyTest.c -o wakeLatencyTest && ./wakeLatencyTest
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "littleThread.h"
+#include "littleThread.c"
+
+#define RUN_NS 3000000000LL
+#define SLEEP_NS 2000000LL
+#define MAX_LATE 60000000LL // three quanta
+
+volatile int stop;
+long long maxLate;
+
+void spinner(void *arg) {
+    while (!stop);
+}
+
+void sleeper(void *arg) {
+    long long end = thread_now() + RUN_NS;
+
+    while (thread_now() < end) {
+        long long start = thread_now(), late;
+        thread_sleep(SLEEP_NS);
+        late = thread_now() - start - SLEEP_NS;
+        if (late > maxLate) maxLate = late;
+    }
+    stop = 1;
+}
+
+int main(void) {
+    int spinners[] = { 2, 8, 32 }, failed = 0;
+
+    threadInit();
+    for (int s = 0; s < 3; s++) {
+        stop = 0;
+        maxLate = 0;
+        thread_spawn(sleeper, NULL);
+        for (int i = 0; i < spinners[s]; i++) thread_spawn(spinner, NULL);
+        setUpTimer();
+        printf("%2d spinners: late at most %7.3f ms\n", spinners[s], maxLate / 1e6);
+        if (maxLate > MAX_LATE) failed = 1;
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,48 @@
+/*
+ ============================================================================
+ Name        : workerBench.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : M:N scaling benchmark.
+               Runs the same CPU-bound threads on 1, 2, 4, ... worker
+               pthreads up to the number of cores and prints the speedup.
+               The work is a private LCG rather than wasteTime()'s rand(),
+               whose global lock would be what gets measured.
+               gcc -O2 -pthread workerBench.c -o workerBench && ./workerBench
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "littleThread.h"
+#include "littleThread.c"
+
+#define THREADS 64
+#define ITERATIONS 20000000
+
+volatile unsigned int sink;
+
+void cpuBound(void *arg) {
+    unsigned int x = (unsigned int) (long) arg;
+    for (int i = 0; i < ITERATIONS; i++) x = x * 1103515245 + 12345;
+    sink = x;
+}
+
+int main(void) {
+    int cores = sysconf(_SC_NPROCESSORS_ONLN);
+    double base = 0;
+
+    threadInit();
+    for (int workers = 1; ; workers *= 2) {
+        if (workers > cores) workers = cores;
+        for (long t = 0; t < THREADS; t++) thread_spawn(cpuBound, (void *) t);
+        double start = thread_now();
+        threadRunWorkers(workers);
+        double ms = (thread_now() - start) / 1e6;
+        if (base == 0) base = ms;
+        printf("workers %2d: %8.1f ms  speedup %.2f\n", workers, ms, base / ms);
+        if (workers == cores) break;
+    }
+    return EXIT_SUCCESS;
+}
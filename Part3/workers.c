@@ -0,0 +1,274 @@
+/*
+ ============================================================================
+ Name        : workers.c
+ Author      : Mohan Cao (mcao024)
+ Version     : 1.0
+ Description : M:N mode. Runs the threads on several worker pthreads.
+               Each worker has its own deque of READY threads and steals
+               from the others when it runs dry. A thread always switches
+               back to its worker's loop, and the loop only makes it
+               stealable once its context is saved, so a thread can move
+               to another worker at any switch.
+               A thread that is preempted or yields is pushed back, and
+               the oldest in the deque runs next, so one that never
+               blocks cannot keep the others waiting behind it.
+               A thread that blocks is not pushed back, the loop releases
+               the wait queue it is on instead.
+               Each worker has its own preemption timer, stopped while it
+               is parked. Preemption is disabled while a worker is in its
+               loop and on the way in and out of a thread. A worker that
+               finds no work parks on a futex until more is pushed, or
+               blocks in epoll while threads wait for I/O (io.c).
+ ============================================================================
+ */
+
+#include <pthread.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#define IDLE_SPINS 64 // failed looks for work before a worker parks
+#define IO_POLL_INTERVAL 61 // loop passes between polls for I/O while busy
+
+typedef struct worker {
+    Context context; // the worker's scheduling loop
+    Thread current; // the thread running on this worker
+    Thread runNext; // handed data by current, runs before the deque
+    int preemptDepth; // of the loop while a thread runs
+    atomic_int *parkLock; // released once the thread parking on it is switched out
+    Deque ready; // READY threads, others steal from the top
+    pthread_t pthread;
+    int id;
+    unsigned int seed; // for picking victims
+    unsigned int polls; // loop passes, for IO_POLL_INTERVAL
+} __attribute__((aligned(64))) Worker;
+
+static Worker *workers = NULL;
+static int workerCount = 0; // 0 unless threadRunWorkers is running
+static __thread Worker *localWorker = NULL;
+static atomic_uint workSequence = 0; // bumped whenever work is added, parked workers wait on it
+static atomic_int parkedWorkers = 0;
+
+static void futexWait(atomic_uint *address, unsigned int value, struct timespec *timeout) {
+    syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, value, timeout, NULL, 0);
+}
+
+static void futexWake(atomic_uint *address, int count) {
+    syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/*
+ * Tells parked workers there may be something to steal.
+ * Costs an atomic increment unless a worker is parked.
+ */
+static void notifyWorkers() {
+    atomic_fetch_add(&workSequence, 1);
+    if (atomic_load(&parkedWorkers) > 0) {
+        futexWake(&workSequence, 1);
+        ioInterrupt();
+    }
+}
+
+/*
+ * The worker of the calling pthread, NULL outside M:N mode.
+ * Not inlined so the TLS address is looked up again after every switch,
+ * a thread may come back on another pthread.
+ */
+static __attribute__((noinline)) Worker *thisWorker() {
+    Worker *worker = localWorker;
+    __asm__ volatile("" ::: "memory");
+    return worker;
+}
+
+/*
+ * The id of the calling pthread's worker, 0 outside M:N mode.
+ */
+static int workerId() {
+    Worker *worker = workerCount > 0 ? thisWorker() : NULL;
+    return worker != NULL ? worker->id : 0;
+}
+
+/*
+ * Looks for a READY thread in the other workers' deques.
+ */
+static Thread stealThread(Worker *thief) {
+    int start = rand_r(&thief->seed) % workerCount;
+    for (int i = 0; i < workerCount; i++) {
+        Worker *victim = &workers[(start + i) % workerCount];
+        if (victim == thief) continue;
+        Thread thread = dequeSteal(&victim->ready);
+        if (thread != NULL) return thread;
+    }
+    return NULL;
+}
+
+/*
+ * Called by the worker that switched back from a finished thread, or ran
+ * a coroutine to its end. We are off its stack now so it can go back in
+ * the pool.
+ */
+static void retireThread(Thread thread) {
+    pthread_mutex_lock(&runtimeLock);
+    if (thread->stackAddr != NULL) { // coroutines have none
+        if (stackWatch) recordStackHighWater(thread);
+        stackRelease(thread->stackAddr, thread->stackSize);
+        thread->stackAddr = NULL;
+    }
+    if (headOfList == thread) headOfList = thread->next != thread ? thread->next : NULL;
+    thread->prev->next = thread->next;
+    thread->next->prev = thread->prev;
+    pthread_mutex_unlock(&runtimeLock);
+    threadRelease(thread);
+    if (atomic_fetch_sub(&liveThreads, 1) == 1) { // the last one, let everyone out
+        atomic_fetch_add(&workSequence, 1);
+        futexWake(&workSequence, INT_MAX);
+        ioInterrupt();
+    }
+}
+
+/*
+ * Blocks in the kernel until work may have been added, or the next runtime
+ * timer is due, or (for one worker at a time) an fd waited for is ready.
+ * The deques and the injection queue are checked again after registering
+ * as parked, so a push racing with this either is seen here or sees us
+ * parked and wakes us.
+ * A timer started later is started by a running worker, which sees it
+ * when it parks itself.
+ */
+static Thread parkWorker(Worker *worker) {
+    Thread thread;
+    unsigned int sequence;
+    struct timespec timeout;
+
+    atomic_fetch_add(&parkedWorkers, 1);
+    sequence = atomic_load(&workSequence);
+    if ((thread = stealThread(worker)) == NULL && !injectPending()
+            && atomic_load(&liveThreads) > 0) {
+        struct timespec *until = nextTimerTimeout(&timeout) ? &timeout : NULL;
+        setTimer(0); // no ticks while parked
+        if (!ioPark(sequence, until)) futexWait(&workSequence, sequence, until);
+        setTimer(1);
+    }
+    atomic_fetch_sub(&parkedWorkers, 1);
+    return thread;
+}
+
+/*
+ * A worker's scheduling loop, runs until every thread has finished.
+ */
+static void *workerLoop(void *arg) {
+    Worker *worker = arg;
+    int idle = 0;
+
+    int oldDepth = preemptDepth;
+
+    preemptDepth = 1; // the loop is never preempted
+    localWorker = worker;
+    if (worker->id != 0) startTicking(); // worker 0's timer is started by threadRunWorkers
+    while (atomic_load(&liveThreads) > 0) {
+        Thread thread;
+
+        runTimers();
+        injectDrain();
+        if (++worker->polls % IO_POLL_INTERVAL == 0) ioPoll(0, NULL); // even when never idle
+        if ((thread = worker->runNext) != NULL) worker->runNext = NULL;
+        else thread = dequeTake(&worker->ready);
+        if (thread == NULL && ioPoll(0, NULL) > 0) thread = dequeTake(&worker->ready);
+        if (thread == NULL) thread = stealThread(worker);
+        if (thread == NULL && ++idle > IDLE_SPINS) thread = parkWorker(worker);
+        if (thread == NULL) continue;
+        idle = 0;
+        if (thread->stackless) { // on the loop's stack
+            runCoroutine(thread);
+            continue;
+        }
+        worker->current = thread;
+        thread->state = RUNNING;
+        worker->preemptDepth = preemptDepth;
+        TRACE(TRACE_SWITCH, TRACE_NOBODY, thread->tid);
+        switchContext(worker->context, thread->context);
+        TRACE(TRACE_SWITCH, thread->tid, TRACE_NOBODY);
+        preemptDepth = worker->preemptDepth;
+        worker->current = NULL;
+        if (thread->state == FINISHED) {
+            retireThread(thread);
+        } else if (thread->state == BLOCKED) {
+            spinUnlock(worker->parkLock); // from here a waker may push it
+        } else { // preempted or yielded: the oldest here runs next, or the bottom would only ever run it
+            thread->state = READY;
+            if (worker->runNext == NULL) worker->runNext = dequeSteal(&worker->ready);
+            dequePush(&worker->ready, thread);
+            notifyWorkers();
+        }
+    }
+    if (worker->id != 0) stopTimer();
+    localWorker = NULL;
+    preemptDepth = oldDepth;
+    return NULL;
+}
+
+/*
+ * Switches from the running thread back to its worker's loop, which puts
+ * it back in the deque. Preemption must already be disabled.
+ * May return on another worker.
+ */
+static void workerSwitchOut(Worker *worker) {
+    Thread thread = worker->current;
+
+    thread->preemptDepth = preemptDepth;
+    switchContext(thread->context, worker->context);
+    preemptDepth = thread->preemptDepth;
+}
+
+/*
+ * A thread's start function has returned, preemption is disabled.
+ * Does not return.
+ */
+static void workerThreadFinished(Worker *worker) {
+    worker->current->state = FINISHED;
+    restoreContext(worker->context);
+}
+
+/*
+ * Runs the spawned threads on count worker pthreads, the calling thread
+ * being worker 0, and returns when all of them (and any they spawn) have
+ * finished. Threads in the ready queue are dealt out round robin.
+ */
+void threadRunWorkers(int count) {
+    Thread thread;
+    int i = 0;
+
+    if (count < 1) count = 1;
+    if ((workers = aligned_alloc(64, sizeof(Worker) * count)) == NULL) {
+        perror("allocating workers");
+        exit(EXIT_FAILURE);
+    }
+    memset(workers, 0, sizeof(Worker) * count);
+    for (int w = 0; w < count; w++) {
+        workers[w].id = w;
+        workers[w].seed = w + 1;
+        dequeInit(&workers[w].ready);
+    }
+    while ((thread = readyDequeue()) != NULL) {
+        dequePush(&workers[i++ % count].ready, thread);
+    }
+    workerCount = count;
+    startTimer();
+
+    for (int w = 1; w < count; w++) {
+        if (pthread_create(&workers[w].pthread, NULL, workerLoop, &workers[w]) != 0) {
+            perror("creating worker");
+            exit(EXIT_FAILURE);
+        }
+    }
+    injectListen(1); // worker 0 is signalled for requests while no worker is parked
+    workerLoop(&workers[0]);
+    injectListen(0);
+    for (int w = 1; w < count; w++) pthread_join(workers[w].pthread, NULL);
+
+    stopTimer();
+    workerCount = 0;
+    for (int w = 0; w < count; w++) dequeFree(&workers[w].ready);
+    free(workers);
+    workers = NULL;
+}